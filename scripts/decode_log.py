@@ -0,0 +1,212 @@
+#!/usr/bin/env python3
+#
+# Decode the binary kernel log (see log_set_mode / LOG_MODE_BINARY in
+# src/kernel/debug.h).
+#
+# The kernel only stores the address of the format string, the address of the
+# module name, a TSC timestamp and the raw argument words of each message.
+# This script looks the strings up in kernel.elf and renders the messages.
+#
+# stddbg goes to COM1 when a serial port is present, so capture the log with
+# qemu's serial port, for example:
+#     qemu-system-i386 -serial file:debug.log ...
+#     ./scripts/decode_log.py build/i686_debug/kernel/kernel.elf debug.log
+#
+# With a virtio console the records are sent to its export port instead:
+#     qemu-system-i386 -device virtio-serial-pci \
+#         -chardev file,id=export,path=export.bin \
+#         -device virtserialport,chardev=export,nr=1 ...
+#     ./scripts/decode_log.py build/i686_debug/kernel/kernel.elf export.bin
+#
+# Anything written to stddbg that is not a binary record is passed through.
+
+import argparse
+import re
+import struct
+import sys
+
+RECORD_MAGIC = b'KLOG'
+RECORD_FORMAT = '<IIQIIBBH9I'
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+
+LEVEL_NAMES = {
+    0: 'DEBUG',
+    1: 'INFO',
+    3: 'WARN',
+    4: 'ERROR',
+    5: 'CRITICAL'
+}
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+FORMAT_SPEC = re.compile(
+    r"%([-+ #0']*)(\*|[0-9]*)(?:\.(\*|[0-9]*))?(hh|h|ll|l)?([a-zA-Z%])"
+)
+
+
+class KernelImage:
+    """ The allocated sections of a 32-bit ELF file, indexed by address """
+
+    def __init__(self, path):
+        with open(path, 'rb') as elf_file:
+            data = elf_file.read()
+
+        if data[:4] != b'\x7fELF' or data[4] != 1:
+            raise ValueError(f'{path} is not a 32-bit ELF file')
+
+        shoff, = struct.unpack_from('<I', data, 0x20)
+        shentsize, shnum = struct.unpack_from('<HH', data, 0x2E)
+
+        self.sections = []
+        for i in range(shnum):
+            (_, sh_type, flags, addr, offset, size) = struct.unpack_from(
+                '<IIIIII', data, shoff + i * shentsize
+            )
+            if (flags & SHF_ALLOC) and sh_type != SHT_NOBITS and size > 0:
+                self.sections.append((addr, data[offset:offset + size]))
+
+    def read_string(self, address):
+        for base, contents in self.sections:
+            if base <= address < base + len(contents):
+                start = address - base
+                end = contents.find(b'\0', start)
+                if end < 0:
+                    end = len(contents)
+                return contents[start:end].decode('latin-1')
+        return None
+
+
+def render_number(value, conversion, flags, width, precision):
+    if conversion == 'o':
+        digits = format(value, 'o')
+    elif conversion in 'xXp':
+        # The kernel's format_print always uses upper case hex digits
+        digits = format(value, 'X')
+    else:
+        digits = str(abs(value))
+
+    if precision is not None:
+        digits = digits.rjust(precision, '0')
+        if precision == 0 and value == 0:
+            digits = ''
+
+    prefix = ''
+    if value < 0:
+        prefix = '-'
+    elif '+' in flags and conversion in 'di':
+        prefix = '+'
+    elif ' ' in flags and conversion in 'di':
+        prefix = ' '
+
+    if '#' in flags and conversion in 'xXp':
+        prefix += '0x'
+    elif '#' in flags and conversion == 'o' and value == 0:
+        prefix += '0'
+
+    padding = width - len(prefix) - len(digits)
+    if padding <= 0:
+        return prefix + digits
+    if '-' in flags:
+        return prefix + digits + ' ' * padding
+    if '0' in flags:
+        return prefix + '0' * padding + digits
+    return ' ' * padding + prefix + digits
+
+
+def render(image, format_string, words):
+    args = iter(words)
+
+    def next_word():
+        return next(args, 0)
+
+    def replace(match):
+        flags, width, precision, length, conversion = match.groups()
+
+        if conversion == '%':
+            return '%'
+
+        width = next_word() if width == '*' else int(width or 0)
+        if precision == '*':
+            precision = next_word()
+        elif precision is not None:
+            precision = int(precision or 0)
+
+        if conversion == 'c':
+            return chr(next_word() & 0xFF)
+
+        if conversion == 's':
+            address = next_word()
+            string = image.read_string(address)
+            if string is None:
+                return f'<string at {address:#x}>'
+            return string
+
+        if conversion not in 'diuxXpo':
+            return match.group(0)
+
+        value = next_word()
+        if length == 'll':
+            value |= next_word() << 32
+            if conversion in 'di' and value & (1 << 63):
+                value -= 1 << 64
+        elif conversion in 'di' and value & (1 << 31):
+            value -= 1 << 32
+
+        return render_number(value, conversion, flags, width, precision)
+
+    return FORMAT_SPEC.sub(replace, format_string)
+
+
+def decode(image, log, out, tsc_hz):
+    position = 0
+    while position < len(log):
+        start = log.find(RECORD_MAGIC, position)
+        if start < 0 or start + RECORD_SIZE > len(log):
+            out.write(log[position:].decode('latin-1'))
+            break
+
+        out.write(log[position:start].decode('latin-1'))
+        position = start + RECORD_SIZE
+
+        (_, _, timestamp, module, fmt, level, arg_words, dropped,
+         *args) = struct.unpack_from(RECORD_FORMAT, log, start)
+
+        if dropped:
+            out.write(f'... {dropped} log record(s) dropped ...\n')
+
+        module_name = image.read_string(module) or f'{module:#x}'
+        format_string = image.read_string(fmt)
+        if format_string is None:
+            message = f'<unknown format at {fmt:#x}>'
+        else:
+            message = render(image, format_string, args[:arg_words])
+
+        if tsc_hz:
+            stamp = f'{timestamp / tsc_hz:12.6f}'
+        else:
+            stamp = f'{timestamp:16d}'
+
+        level_name = LEVEL_NAMES.get(level, str(level))
+        out.write(f'[{stamp}] {level_name:8s} [{module_name}] {message}\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode a binary kernel log')
+    parser.add_argument('kernel', help='The kernel.elf the log came from')
+    parser.add_argument('log', help='The captured stddbg output')
+    parser.add_argument(
+        '--tsc-hz', type=float, default=None,
+        help='TSC frequency, used to print timestamps in seconds'
+    )
+    args = parser.parse_args()
+
+    image = KernelImage(args.kernel)
+    with open(args.log, 'rb') as log_file:
+        log = log_file.read()
+
+    decode(image, log, sys.stdout, args.tsc_hz)
+
+
+if __name__ == '__main__':
+    main()
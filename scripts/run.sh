@@ -1,6 +1,6 @@
 #!/bin/bash
 
-QEMU_ARGS='-debugcon stdio -m 32'
+QEMU_ARGS='-debugcon stdio -serial file:serial.log -m 32'
 
 if [ "$#" -le 0 ]; then
     echo "Usage: ./run.sh <image>"
@@ -1,5 +1,6 @@
 #include "acpi.h"
 
+#include <arch/i686/io.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -24,13 +25,82 @@ typedef struct {
 
 typedef struct {
     ACPI_SDT_Header header;
-    ACPI_SDT_Header *entries;
+    uint32_t entries[];         // 64 bit pairs when this is an XSDT
 } RSDT;
 
+typedef struct {
+    ACPI_SDT_Header header;
+    uint32_t local_apic_address;
+    uint32_t flags;
+    uint8_t entries[];
+} __attribute__((packed)) MADT;
+
+typedef struct {
+    uint64_t base;
+    uint16_t segment;
+    uint8_t start_bus;
+    uint8_t end_bus;
+    uint32_t reserved;
+} __attribute__((packed)) MCFG_Entry;
+
+typedef struct {
+    ACPI_SDT_Header header;
+    uint64_t reserved;
+    MCFG_Entry entries[];
+} __attribute__((packed)) MCFG;
+
+static enum {
+    MADT_PCAT_COMPAT            = 0x1,
+
+    MADT_TYPE_LOCAL_APIC        = 0,
+    MADT_TYPE_IO_APIC           = 1,
+    MADT_TYPE_OVERRIDE          = 2,
+
+    MADT_LOCAL_APIC_ENABLED     = 0x1
+} MADT_VALUES;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) MADT_Entry;
+
+typedef struct {
+    MADT_Entry entry;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) MADT_LocalAPIC;
+
+typedef struct {
+    MADT_Entry entry;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} __attribute__((packed)) MADT_IOAPIC;
+
+typedef struct {
+    MADT_Entry entry;
+    uint8_t bus;
+    uint8_t irq;
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed)) MADT_Override;
+
+static enum {
+    FADT_TIMER_32BIT            = 0x100
+} FADT_FLAGS;
+
 static RSDT* rsdt = NULL;
 static FADT* fadt = NULL;
 static bool use_xsdt = false;
 
+static MADT_Info madt_info;
+static bool has_madt = false;
+
+static MCFG_Region mcfg_region;
+static bool has_mcfg = false;
+
 static const int RSDP_SIZE = 0x8 + 0x1 + 0x6 + 0x1 + 0x4;
 
 static bool is_rsdp_valid(E_RSDP *rsdp) {
@@ -63,13 +133,11 @@ static void *find_table(const char* signature) {
 
     ACPI_SDT_Header *header;
     for (int i = 0; i < entries; i++) {
-        //* If this is 64-bit code this may have to be changed since
-        //* pointers will already be 64 bits and there will be no need to
-        //* multiply by 2
+        // Only the low half of an XSDT entry can be used without paging
         if (use_xsdt)
-            header = &(rsdt->entries[i*2]);
+            header = (ACPI_SDT_Header *)rsdt->entries[i*2];
         else
-            header = &(rsdt->entries[i]);
+            header = (ACPI_SDT_Header *)rsdt->entries[i];
         if (memcmp(header->signature, signature, 4) == 0) return header;
     }
 
@@ -77,7 +145,7 @@ static void *find_table(const char* signature) {
 }
 
 static bool has_valid_checksum(ACPI_SDT_Header *table_header) {
-    unsigned char sum;
+    unsigned char sum = 0;
     for (int i = 0; i < table_header->length; i++) {
         sum += ((char *)table_header)[i];
     }
@@ -103,10 +171,121 @@ static E_RSDP *find_rsdp(int mem_min, int mem_max)
     return NULL;
 }
 
+/**
+ * Record the processors, I/O APICs and legacy IRQ overrides in the MADT.
+*/
+static void parse_madt(MADT *madt) {
+    madt_info.local_apic_address = madt->local_apic_address;
+    madt_info.has_8259 = (madt->flags & MADT_PCAT_COMPAT) != 0;
+
+    for (int i = 0; i < 16; i++) {
+        madt_info.irq_gsi[i] = i;
+        madt_info.irq_flags[i] = 0;
+    }
+
+    uint16_t overridden = 0;
+    uint8_t *entry = madt->entries;
+    uint8_t *end = (uint8_t *)madt + madt->header.length;
+    while (entry + sizeof(MADT_Entry) <= end) {
+        MADT_Entry *header = (MADT_Entry *)entry;
+        if (header->length < sizeof(MADT_Entry)) break;
+
+        switch (header->type) {
+        case MADT_TYPE_LOCAL_APIC: {
+            MADT_LocalAPIC *local = (MADT_LocalAPIC *)entry;
+            if ((local->flags & MADT_LOCAL_APIC_ENABLED) &&
+                madt_info.cpu_count < MADT_MAX_CPUS)
+                madt_info.cpu_apic_ids[madt_info.cpu_count++] = local->apic_id;
+            break;
+        }
+        case MADT_TYPE_IO_APIC: {
+            MADT_IOAPIC *io = (MADT_IOAPIC *)entry;
+            if (madt_info.io_apic_count < MADT_MAX_IO_APICS) {
+                MADT_IO_APIC *info = &madt_info.io_apics[madt_info.io_apic_count++];
+                info->id = io->id;
+                info->address = io->address;
+                info->gsi_base = io->gsi_base;
+            }
+            break;
+        }
+        case MADT_TYPE_OVERRIDE: {
+            MADT_Override *override = (MADT_Override *)entry;
+            if (override->bus == 0 && override->irq < 16) {
+                madt_info.irq_gsi[override->irq] = override->gsi;
+                madt_info.irq_flags[override->irq] = override->flags;
+                overridden |= 1 << override->irq;
+            }
+            break;
+        }
+        }
+
+        entry += header->length;
+    }
+
+    // An override moves an IRQ onto another IRQ's identity GSI, e.g. the PIT
+    // onto GSI 2, so that IRQ no longer has an input of its own
+    for (int i = 0; i < 16; i++) {
+        if (overridden & (1 << i)) continue;
+        for (int j = 0; j < 16; j++) {
+            if (j != i && (overridden & (1 << j)) && madt_info.irq_gsi[j] == i) {
+                madt_info.irq_gsi[i] = MADT_NO_GSI;
+                break;
+            }
+        }
+    }
+
+    has_madt = true;
+    log_info("ACPI", "MADT: %d CPUs, %d I/O APICs, local APIC at %#x",
+        madt_info.cpu_count, madt_info.io_apic_count,
+        madt_info.local_apic_address);
+}
+
+static void parse_mcfg(MCFG *mcfg) {
+    int count = (mcfg->header.length - sizeof(MCFG)) / sizeof(MCFG_Entry);
+
+    for (int i = 0; i < count; i++) {
+        MCFG_Entry *entry = &mcfg->entries[i];
+
+        // Only segment 0 is scanned, and only memory below 4GiB can be used
+        // without paging
+        if (entry->segment != 0 || (entry->base >> 32) != 0) continue;
+
+        mcfg_region.base = entry->base;
+        mcfg_region.start_bus = entry->start_bus;
+        mcfg_region.end_bus = entry->end_bus;
+        has_mcfg = true;
+
+        log_info("ACPI", "MCFG: PCI buses %d-%d configured at %#x",
+            entry->start_bus, entry->end_bus, mcfg_region.base);
+        return;
+    }
+}
+
 FADT* get_fadt() {
     return fadt;
 }
 
+bool acpi_pm_timer_present() {
+    return fadt != NULL && fadt->pm_timer_block != 0 &&
+        fadt->pm_timer_length == 4;
+}
+
+uint32_t acpi_pm_timer_mask() {
+    return (fadt->flags & FADT_TIMER_32BIT) ? 0xFFFFFFFF : 0x00FFFFFF;
+}
+
+uint32_t acpi_pm_timer_read() {
+    return in_double(fadt->pm_timer_block) & acpi_pm_timer_mask();
+}
+
+const MADT_Info* acpi_get_madt_info() {
+    return has_madt ? &madt_info : NULL;
+}
+
+const MCFG_Region* acpi_get_mcfg_region() {
+    return has_mcfg ? &mcfg_region : NULL;
+}
+
 void acpi_initialize() {
     const uint16_t *ebda_ptr = (uint16_t *)0xA0E;
     const uint16_t *ebda_length = (uint16_t *)0xA13;
@@ -120,19 +299,19 @@ void acpi_initialize() {
         // no return
     }
     
-    printf("Found RSDP at %p\n", rsdp);
-    printf("RSDP Version: %d\n", rsdp->revision);
-    printf("RSDT Address: %#x\n", rsdp->rsdt_address);
-    printf("XSDT Address: %#x\n", rsdp->xsdt_address);
+    log_info("ACPI", "Found RSDP at %p", rsdp);
+    log_info("ACPI", "RSDP Version: %d", rsdp->revision);
+    log_info("ACPI", "RSDT Address: %#x", rsdp->rsdt_address);
+    log_info("ACPI", "XSDT Address: %#x", rsdp->xsdt_address);
 
     if (rsdp->revision == 0) {
         rsdt = (RSDT *)rsdp->rsdt_address;
         use_xsdt = false;
-        printf("  Using RSDT\n");
+        log_info("ACPI", "Using RSDT");
     } else {
         rsdt = (RSDT *)(uint32_t)rsdp->xsdt_address;
         use_xsdt = true;
-        printf("  Using XSDT\n");
+        log_info("ACPI", "Using XSDT");
     }
 
     
@@ -149,5 +328,15 @@ void acpi_initialize() {
     // hexdump(stdout, fadt, sizeof(FADT));
     // printf("FACS Bytes: \n");
     // hexdump(stdout, (void *)(fadt->firmware_ctrl), 32);
-    printf("ACPI Version: %d\n", fadt->header.revision);
+    log_info("ACPI", "ACPI Version: %d", fadt->header.revision);
+
+    MADT *madt = find_table("APIC");
+    if (madt != NULL && has_valid_checksum(&madt->header))
+        parse_madt(madt);
+    else
+        log_info("ACPI", "No MADT");
+
+    MCFG *mcfg = find_table("MCFG");
+    if (mcfg != NULL && has_valid_checksum(&mcfg->header))
+        parse_mcfg(mcfg);
 }
\ No newline at end of file
@@ -1,7 +1,15 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
+// Most processors and I/O APICs recorded from the MADT
+#define MADT_MAX_CPUS       16
+#define MADT_MAX_IO_APICS   4
+
+// Legacy IRQ whose identity mapped GSI was claimed by another IRQ's override
+#define MADT_NO_GSI         0xFFFFFFFF
+
 typedef struct {
     char signature[4];
     uint32_t length;
@@ -61,6 +69,77 @@ typedef struct {
 } __attribute__((packed)) FADT;
 
 
+typedef struct {
+    uint8_t id;
+    uint32_t address;
+    uint32_t gsi_base;          // First global system interrupt it handles
+} MADT_IO_APIC;
+
+/**
+ * The interrupt controllers described by the MADT. Legacy IRQs are identity
+ * mapped to global system interrupts unless the MADT overrides them, or
+ * another IRQ is overridden onto their GSI, which leaves them MADT_NO_GSI.
+*/
+typedef struct {
+    uint32_t local_apic_address;
+    bool has_8259;              // Dual 8259s are also installed
+
+    int cpu_count;
+    uint8_t cpu_apic_ids[MADT_MAX_CPUS];    // Only enabled processors
+
+    int io_apic_count;
+    MADT_IO_APIC io_apics[MADT_MAX_IO_APICS];
+
+    uint32_t irq_gsi[16];       // Global system interrupt of each legacy IRQ
+    uint16_t irq_flags[16];     // MPS INTI flags, polarity and trigger mode
+} MADT_Info;
+
+/**
+ * The memory mapped PCI configuration space (ECAM) of segment 0, from the
+ * MCFG. Each function's 4KiB is at base + (bus - start_bus) << 20 |
+ * device << 15 | function << 12.
+*/
+typedef struct {
+    uint32_t base;
+    uint8_t start_bus;
+    uint8_t end_bus;
+} MCFG_Region;
+
+// Rate of the ACPI power management timer in Hz
+#define ACPI_PM_TIMER_FREQUENCY 3579545
+
 FADT* get_fadt();
 
+/**
+ * Returns:
+ *   Whether the FADT describes a power management timer
+*/
+bool acpi_pm_timer_present();
+
+/**
+ * Returns:
+ *   The mask of the bits the power management timer counts in, it is either
+ *   24 or 32 bits wide
+*/
+uint32_t acpi_pm_timer_mask();
+
+/**
+ * Returns:
+ *   The current count of the power management timer
+*/
+uint32_t acpi_pm_timer_read();
+
+/**
+ * Returns:
+ *   The interrupt controllers found in the MADT, or NULL if there is none
+*/
+const MADT_Info* acpi_get_madt_info();
+
+/**
+ * Returns:
+ *   The ECAM region of PCI segment 0, or NULL if there is no MCFG or the
+ *   region is above 4GiB
+*/
+const MCFG_Region* acpi_get_mcfg_region();
+
 void acpi_initialize();
\ No newline at end of file
@@ -1,6 +1,11 @@
 #include "apic.h"
 
+#include <arch/i686/acpi.h>
+#include <arch/i686/i8259.h>
+#include <arch/i686/io.h>
+#include <arch/i686/isr.h>
 #include <cpuid.h>
+#include <debug.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -10,9 +15,53 @@
 #define IA32_APIC_BASE_MSR 0x1B
 #define IA32_APIC_BASE_MSR_BSP (1 << 8)
 #define IA32_APIC_BASE_MSR_ENABLE (1 << 11)
+#define LEGACY_CASCADE_IRQ 2
+
+static enum {
+    LAPIC_REG_ID                = 0x20,
+    LAPIC_REG_VERSION           = 0x30,
+    LAPIC_REG_TASK_PRIORITY     = 0x80,
+    LAPIC_REG_EOI               = 0xB0,
+    LAPIC_REG_SPURIOUS          = 0xF0,
+    LAPIC_REG_ICR_LOW           = 0x300,
+    LAPIC_REG_ICR_HIGH          = 0x310,
+    LAPIC_REG_LVT_LINT0         = 0x350,
+    LAPIC_REG_LVT_LINT1         = 0x360,
+} LAPIC_REGISTERS;
+
+static enum {
+    IOAPIC_REG_SELECT           = 0x00,
+    IOAPIC_REG_WINDOW           = 0x10,
+
+    IOAPIC_VERSION              = 0x01,
+    IOAPIC_REDIRECTION_TABLE    = 0x10,
+} IOAPIC_REGISTERS;
+
+static enum {
+    LAPIC_SPURIOUS_ENABLE       = 0x100,
+    LAPIC_LVT_MASKED            = 0x10000,
+
+    ICR_DELIVERY_FIXED          = 0x000,
+    ICR_DELIVERY_INIT           = 0x500,
+    ICR_DELIVERY_STARTUP        = 0x600,
+    ICR_DELIVERY_PENDING        = 0x1000,
+    ICR_LEVEL_ASSERT            = 0x4000,
+
+    REDIRECT_MASKED             = 0x10000,
+    REDIRECT_LEVEL              = 0x8000,
+    REDIRECT_ACTIVE_LOW         = 0x2000,
+
+    INTI_POLARITY_MASK          = 0x3,
+    INTI_POLARITY_LOW           = 0x3,
+    INTI_TRIGGER_MASK           = 0xC,
+    INTI_TRIGGER_LEVEL          = 0xC,
+} APIC_BITS;
 
-static bool is_boot_cpu;
 static uintptr_t apic_base = 0xFEE00000;
+static const MADT_Info *madt = NULL;
+static uint8_t vector_base = 0;
+static uint32_t spurious_count = 0;
+static bool enabled = false;
 
 static bool is_apic_supported() {
     unsigned int eax, edx, unused;
@@ -20,29 +69,6 @@ static bool is_apic_supported() {
     return (edx & CPU_FEAT_EDX_APIC) != 0;
 }
 
-/**
- * Determine whether the APIC MSR indicates this is a boot cpu or not
-*/
-static bool determine_if_boot_cpu() {
-    uint32_t eax, edx;
-    msr_get(IA32_APIC_BASE_MSR, &eax, &edx);
-
-    return eax & IA32_APIC_BASE_MSR_BSP;
-}
-
-static uintptr_t get_apic_base() {
-    uint32_t eax, edx;
-    msr_get(IA32_APIC_BASE_MSR, &eax, &edx);
-
-    // If more than 32 bits can be used for an address then 
-    // include the 4 high bits of the address
-#ifdef __PHYSICAL_MEMORY_EXTENSION__
-        return (eax & 0xfffff000) | ((edx & 0x0f) << 32);
-#else
-        return (eax & 0xfffff000);
-#endif
-}
-
 static void set_apic_base(uintptr_t base) {
     uint32_t edx = 0;
     uint32_t eax = (base & 0xfffff000) | IA32_APIC_BASE_MSR_ENABLE;
@@ -56,35 +82,235 @@ static void set_apic_base(uintptr_t base) {
     msr_set(IA32_APIC_BASE_MSR, eax, edx);
 }
 
-uint32_t read_register(uint32_t reg_offset) {
+static uint32_t lapic_read(uint32_t reg_offset) {
     uint32_t volatile *reg = (uint32_t volatile *)(apic_base + reg_offset);
     return *reg;
 }
 
-void write_register(uint32_t reg_offset, uint32_t value) {
+static void lapic_write(uint32_t reg_offset, uint32_t value) {
     uint32_t volatile *reg = (uint32_t volatile *)(apic_base + reg_offset);
     *reg = value;
 }
 
-void apic_initialize() {
-    // if (!is_apic_supported()) {
-    //     printf("APIC is not Supported\n");
-    //     return;
-    // }
+static uint32_t ioapic_read(const MADT_IO_APIC *io, uint8_t reg) {
+    *(uint32_t volatile *)(io->address + IOAPIC_REG_SELECT) = reg;
+    return *(uint32_t volatile *)(io->address + IOAPIC_REG_WINDOW);
+}
 
+static void ioapic_write(const MADT_IO_APIC *io, uint8_t reg, uint32_t value) {
+    *(uint32_t volatile *)(io->address + IOAPIC_REG_SELECT) = reg;
+    *(uint32_t volatile *)(io->address + IOAPIC_REG_WINDOW) = value;
+}
 
-    // pic_configure(0x20, 0x28, false);
-    // pic_disable();
-    // printf("Disabled PIC\n");
-    
-    // apic_base = get_apic_base();
+static int ioapic_entry_count(const MADT_IO_APIC *io) {
+    return ((ioapic_read(io, IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+}
 
-    // // Set the apic base to ensure enabled bit is set
-    // set_apic_base(apic_base);
+/**
+ * Find the I/O APIC that handles global system interrupt [gsi].
+ * 
+ * Parameters:
+ *   gsi: The global system interrupt
+ *   pin: Set to the input of the I/O APIC the interrupt arrives on
+ * 
+ * Returns:
+ *   The I/O APIC, or NULL if none handles the interrupt
+*/
+static const MADT_IO_APIC *find_ioapic(uint32_t gsi, int *pin) {
+    for (int i = 0; i < madt->io_apic_count; i++) {
+        const MADT_IO_APIC *io = &madt->io_apics[i];
+        if (gsi >= io->gsi_base && gsi < io->gsi_base + ioapic_entry_count(io)) {
+            *pin = gsi - io->gsi_base;
+            return io;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Check whether legacy [irq] has an I/O APIC input of its own. IRQ 2 is the
+ * 8259 cascade and never raised, and an IRQ whose GSI another IRQ was
+ * overridden onto has no input.
+*/
+static bool is_irq_routable(int irq) {
+    return irq != LEGACY_CASCADE_IRQ && madt->irq_gsi[irq] != MADT_NO_GSI;
+}
 
-    // // Set the Spurious Interrupt Vector Register to 0x1FF
-    // // 0x100 to enable the APIC and 0xFF as the spurious interrupt number.
-    // write_register(0xF0, 0x1FF);
+/**
+ * Set or clear the mask bit in the redirection entry of legacy [irq].
+*/
+static void set_irq_masked(int irq, bool masked) {
+    if (!is_irq_routable(irq)) return;
+
+    int pin;
+    const MADT_IO_APIC *io = find_ioapic(madt->irq_gsi[irq], &pin);
+    if (io == NULL) return;
+
+    uint8_t reg = IOAPIC_REDIRECTION_TABLE + pin * 2;
+    uint32_t low = ioapic_read(io, reg);
+    if (masked)
+        low |= REDIRECT_MASKED;
+    else
+        low &= ~REDIRECT_MASKED;
+    ioapic_write(io, reg, low);
+}
 
-    // printf("Enabled APIC\n");
-}
\ No newline at end of file
+/**
+ * Route legacy [irq] to vector_base + irq on this CPU, masked. ISA
+ * interrupts are edge triggered and active high unless the MADT says
+ * otherwise.
+*/
+static void route_irq(int irq, uint8_t destination) {
+    int pin;
+    const MADT_IO_APIC *io = find_ioapic(madt->irq_gsi[irq], &pin);
+    if (io == NULL) {
+        log_warn("APIC", "No I/O APIC handles IRQ %d", irq);
+        return;
+    }
+
+    uint16_t flags = madt->irq_flags[irq];
+    uint32_t low = (vector_base + irq) | REDIRECT_MASKED;
+    if ((flags & INTI_POLARITY_MASK) == INTI_POLARITY_LOW)
+        low |= REDIRECT_ACTIVE_LOW;
+    if ((flags & INTI_TRIGGER_MASK) == INTI_TRIGGER_LEVEL)
+        low |= REDIRECT_LEVEL;
+
+    uint8_t reg = IOAPIC_REDIRECTION_TABLE + pin * 2;
+    ioapic_write(io, reg + 1, (uint32_t)destination << 24);
+    ioapic_write(io, reg, low);
+}
+
+static void spurious_interrupt(Registers *regs) {
+    spurious_count++;
+}
+
+/**
+ * Send an inter-processor interrupt to the CPU with local APIC [apic_id] and
+ * wait for it to be accepted.
+*/
+static void send_ipi(uint8_t apic_id, uint32_t command) {
+    lapic_write(LAPIC_REG_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, command);
+    while (lapic_read(LAPIC_REG_ICR_LOW) & ICR_DELIVERY_PENDING)
+        cpu_relax();
+}
+
+/**
+ * Enable the local APIC of the calling CPU.
+*/
+static void enable_local_apic() {
+    set_apic_base(apic_base);
+    lapic_write(LAPIC_REG_SPURIOUS, LAPIC_SPURIOUS_ENABLE | APIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_REG_TASK_PRIORITY, 0);
+}
+
+static bool probe() {
+    madt = acpi_get_madt_info();
+    return is_apic_supported() && madt != NULL && madt->io_apic_count > 0;
+}
+
+static void disable() {
+    for (int i = 0; i < madt->io_apic_count; i++) {
+        const MADT_IO_APIC *io = &madt->io_apics[i];
+        int count = ioapic_entry_count(io);
+        for (int pin = 0; pin < count; pin++) {
+            uint8_t reg = IOAPIC_REDIRECTION_TABLE + pin * 2;
+            ioapic_write(io, reg, ioapic_read(io, reg) | REDIRECT_MASKED);
+        }
+    }
+}
+
+static void initialize(uint8_t offset_pic1, uint8_t offset_pic2, bool auto_eoi) {
+    // Move the 8259s away from the exception vectors before masking them, in
+    // case they raise a spurious interrupt
+    if (madt->has_8259) {
+        const PIC_Driver *i8259 = i8259_get_driver();
+        i8259->initialize(offset_pic1, offset_pic2, false);
+        i8259->disable();
+    }
+
+    apic_base = madt->local_apic_address;
+    isr_register_handler(APIC_SPURIOUS_VECTOR, spurious_interrupt);
+    enable_local_apic();
+
+    // Legacy interrupts come through the I/O APIC instead of LINT0
+    lapic_write(LAPIC_REG_LVT_LINT0, LAPIC_LVT_MASKED);
+
+    disable();
+    vector_base = offset_pic1;
+    // Pins no legacy IRQ is routed to stay masked by disable()
+    uint8_t destination = apic_local_id();
+    for (int irq = 0; irq < 16; irq++) {
+        if (is_irq_routable(irq)) route_irq(irq, destination);
+    }
+    enabled = true;
+
+    log_info("APIC", "Local APIC %d version %#x, %d I/O APICs",
+        destination, lapic_read(LAPIC_REG_VERSION) & 0xFF, madt->io_apic_count);
+}
+
+static void send_eoi(int irq) {
+    apic_eoi();
+}
+
+static void mask(int irq) {
+    set_irq_masked(irq, true);
+}
+
+static void unmask(int irq) {
+    set_irq_masked(irq, false);
+}
+
+static void fast_eoi(int irq, ISR_FastEOI *eoi) {
+    eoi->reg = apic_eoi_register();
+    eoi->slave_command = 0;
+    eoi->master_command = 0;
+}
+
+static const PIC_Driver driver = {
+    .name = "APIC",
+    .probe = &probe,
+    .initialize = &initialize,
+    .disable = &disable,
+    .send_eoi = &send_eoi,
+    .mask = &mask,
+    .unmask = &unmask,
+    .is_spurious = NULL,
+    .fast_eoi = &fast_eoi
+};
+
+const PIC_Driver* apic_get_driver() {
+    return &driver;
+}
+
+uint8_t apic_local_id() {
+    return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+bool apic_enabled() {
+    return enabled;
+}
+
+void apic_initialize_cpu() {
+    enable_local_apic();
+}
+
+void apic_eoi() {
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+volatile uint32_t *apic_eoi_register() {
+    return (volatile uint32_t *)(apic_base + LAPIC_REG_EOI);
+}
+
+void apic_send_init(uint8_t apic_id) {
+    send_ipi(apic_id, ICR_DELIVERY_INIT | ICR_LEVEL_ASSERT);
+}
+
+void apic_send_startup(uint8_t apic_id, uint32_t address) {
+    send_ipi(apic_id, ICR_DELIVERY_STARTUP | ICR_LEVEL_ASSERT | (address >> 12));
+}
+
+void apic_send_ipi(uint8_t apic_id, uint8_t vector) {
+    send_ipi(apic_id, ICR_DELIVERY_FIXED | ICR_LEVEL_ASSERT | vector);
+}
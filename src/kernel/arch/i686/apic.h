@@ -1,3 +1,62 @@
 #pragma once
 
-void apic_initialize();
\ No newline at end of file
+#include "pic.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Vector the local APIC raises when an interrupt goes away before it is
+// delivered. It is never acknowledged.
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+/**
+ * Returns:
+ *   The driver for the local APIC and the I/O APICs found in the MADT
+*/
+const PIC_Driver* apic_get_driver();
+
+/**
+ * Returns:
+ *   The id of the local APIC of the CPU this is running on
+*/
+uint8_t apic_local_id();
+
+/**
+ * Returns:
+ *   Whether the APIC driver is handling interrupts
+*/
+bool apic_enabled();
+
+/**
+ * Enable the local APIC of an application processor. The boot processor's
+ * is enabled when the driver is initialized.
+*/
+void apic_initialize_cpu();
+
+/**
+ * Acknowledge the interrupt being handled by the calling CPU.
+*/
+void apic_eoi();
+
+/**
+ * Returns:
+ *   The local APIC's EOI register, for fast path stubs to write directly.
+ *   Every CPU sees its own local APIC at the same address.
+*/
+volatile uint32_t *apic_eoi_register();
+
+/**
+ * Send an INIT IPI to the CPU with local APIC [apic_id], resetting it into
+ * the wait-for-SIPI state.
+*/
+void apic_send_init(uint8_t apic_id);
+
+/**
+ * Send a startup IPI to the CPU with local APIC [apic_id]. It starts in
+ * real mode at [address], which must be page aligned and below 1MiB.
+*/
+void apic_send_startup(uint8_t apic_id, uint32_t address);
+
+/**
+ * Raise [vector] on the CPU with local APIC [apic_id].
+*/
+void apic_send_ipi(uint8_t apic_id, uint8_t vector);
@@ -0,0 +1,196 @@
+#include "fpu.h"
+
+#include "io.h"
+#include "irq.h"
+#include "isr.h"
+#include "smp.h"
+#include <cpuid.h>
+#include <debug.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <task.h>
+
+static enum {
+    CR0_MP                      = 0x2,      // WAIT honours TS
+    CR0_EM                      = 0x4,      // Emulate the FPU
+    CR0_TS                      = 0x8,      // Task switched, FPU use raises #NM
+    CR0_NE                      = 0x20,     // Native FPU error reporting
+
+    CR4_OSFXSR                  = 0x200,    // FXSAVE, FXRSTOR and SSE
+    CR4_OSXMMEXCPT              = 0x400,    // SIMD exceptions raise #XM
+
+    CPU_FEAT_EDX_FPU            = 0x1,
+    CPU_FEAT_EDX_FXSR           = 0x1000000,
+    CPU_FEAT_EDX_SSE            = 0x2000000,
+
+    MXCSR_DEFAULT               = 0x1F80,   // All exceptions masked
+
+    EFLAGS_IF                   = 0x200,
+
+    VECTOR_DEVICE_NOT_AVAILABLE = 7
+} FPU_VALUES;
+
+typedef struct {
+    Thread *owner;              // The thread whose state is in the registers
+    int borrowed;               // Depth of borrowing kernel_fpu_begin calls
+    uint32_t flags;             // Interrupt state to restore when borrowing ends
+} FPU_CPU;
+
+void ASMCALL fpu_clear_ts();
+void ASMCALL fpu_save(void *area);
+void ASMCALL fpu_restore(const void *area);
+void ASMCALL fpu_reset();
+void ASMCALL fpu_load_mxcsr(uint32_t mxcsr);
+
+static FPU_CPU cpu_state[MAX_CPUS];
+static bool enabled = false;
+static bool available = false;
+
+// The state new threads start from
+static uint8_t initial_state[FPU_STATE_SIZE]
+    __attribute__((aligned(FPU_STATE_ALIGN)));
+
+static void set_ts() {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static void enable_on_cpu() {
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+
+    // CR4.OSXMMEXCPT and MXCSR only exist on CPUs with SSE
+    uint32_t cr4 = read_cr4() | CR4_OSFXSR;
+    if (available) cr4 |= CR4_OSXMMEXCPT;
+    write_cr4(cr4);
+
+    fpu_reset();
+    if (available) fpu_load_mxcsr(MXCSR_DEFAULT);
+
+    // Every use has to go through kernel_fpu_begin or a thread's #NM
+    set_ts();
+}
+
+/**
+ * Put the current thread's state in the registers, saving the state of the
+ * thread that had them. Must be called on the boot CPU with interrupts
+ * disabled.
+*/
+static void take_ownership() {
+    FPU_CPU *cpu = &cpu_state[0];
+    Thread *current = thread_current();
+
+    fpu_clear_ts();
+    if (cpu->owner == current) return;
+
+    if (current->fpu_state == NULL) {
+        current->fpu_state = aligned_alloc(FPU_STATE_ALIGN, FPU_STATE_SIZE);
+        if (current->fpu_state == NULL)
+            panic("FPU", "Could not allocate FPU state for %s", current->name);
+        memcpy(current->fpu_state, initial_state, FPU_STATE_SIZE);
+    }
+
+    if (cpu->owner != NULL) fpu_save(cpu->owner->fpu_state);
+    fpu_restore(current->fpu_state);
+    cpu->owner = current;
+}
+
+/**
+ * Returns:
+ *   Whether the caller is a thread that owns the registers it uses. Threads
+ *   only run on the boot CPU, and not inside interrupt handlers.
+*/
+static bool in_thread(uint32_t flags) {
+    return smp_cpu_id() == 0 && (flags & EFLAGS_IF) && !irq_in_handler();
+}
+
+static void device_not_available(Registers *regs) {
+    // A thread used the FPU for the first time since it was switched to
+    if (in_thread(regs->eflags)) {
+        take_ownership();
+        return;
+    }
+
+    panic("FPU", "FPU used outside kernel_fpu_begin at %#x", regs->eip);
+}
+
+void fpu_initialize() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+        !(edx & CPU_FEAT_EDX_FPU) || !(edx & CPU_FEAT_EDX_FXSR)
+    ) {
+        log_warn("FPU", "No FPU with FXSAVE, SIMD code will not be used");
+        return;
+    }
+
+    available = (edx & CPU_FEAT_EDX_SSE) != 0;
+    isr_register_handler(VECTOR_DEVICE_NOT_AVAILABLE, device_not_available);
+
+    // Capture the reset state once so new threads can start from it
+    enable_on_cpu();
+    fpu_clear_ts();
+    fpu_save(initial_state);
+    set_ts();
+
+    enabled = true;
+
+    log_info("FPU", "FPU enabled, SSE %s, lazy switching",
+        available ? "available" : "missing");
+}
+
+void fpu_initialize_cpu() {
+    if (enabled) enable_on_cpu();
+}
+
+bool fpu_sse_available() {
+    return available;
+}
+
+void kernel_fpu_begin() {
+    if (!enabled) return;
+    uint32_t flags = save_and_disable_interrupts();
+
+    if (in_thread(flags)) {
+        take_ownership();
+        restore_interrupts(flags);
+        return;
+    }
+
+    // Borrow the registers, saving the owner's state so it is reloaded
+    // through #NM the next time it uses them
+    FPU_CPU *cpu = &cpu_state[smp_cpu_id()];
+    if (cpu->borrowed++ > 0) return;
+
+    cpu->flags = flags;
+    fpu_clear_ts();
+    if (cpu->owner != NULL) {
+        fpu_save(cpu->owner->fpu_state);
+        cpu->owner = NULL;
+    }
+    fpu_restore(initial_state);
+}
+
+void kernel_fpu_end() {
+    if (!enabled) return;
+
+    // Threads keep the registers, they are saved when another thread or a
+    // borrower needs them
+    FPU_CPU *cpu = &cpu_state[smp_cpu_id()];
+    if (cpu->borrowed == 0) return;
+    if (--cpu->borrowed > 0) return;
+
+    set_ts();
+    restore_interrupts(cpu->flags);
+}
+
+void fpu_switch_to(Thread *next) {
+    if (!enabled) return;
+
+    if (cpu_state[0].owner == next)
+        fpu_clear_ts();
+    else
+        set_ts();
+}
+
+void fpu_thread_exit(Thread *thread) {
+    if (cpu_state[0].owner == thread) cpu_state[0].owner = NULL;
+}
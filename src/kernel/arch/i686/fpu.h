@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <thread.h>
+
+// Size and alignment of the area FXSAVE stores the FPU and SSE registers in
+#define FPU_STATE_SIZE 512
+#define FPU_STATE_ALIGN 16
+
+/**
+ * Enable the FPU and SSE on the boot CPU and take #NM for lazy switching.
+ * Threads get their own FPU state the first time they use it. Must be
+ * called before thread_initialize.
+*/
+void fpu_initialize();
+
+/**
+ * Enable the FPU and SSE on an application processor. They have no threads,
+ * so SIMD code there must always be inside kernel_fpu_begin and end.
+*/
+void fpu_initialize_cpu();
+
+/**
+ * Returns:
+ *   Whether SSE can be used between kernel_fpu_begin and kernel_fpu_end
+*/
+bool fpu_sse_available();
+
+/**
+ * Start a section that uses FPU or SSE registers. In a thread on the boot
+ * CPU the registers become the thread's own and stay so across preemption.
+ * In interrupt handlers, tasklets, on the application processors or with
+ * interrupts disabled, the registers are borrowed and interrupts stay
+ * disabled until kernel_fpu_end. Sections can nest.
+*/
+void kernel_fpu_begin();
+
+/**
+ * End a section started by kernel_fpu_begin.
+*/
+void kernel_fpu_end();
+
+/**
+ * Called by the scheduler just before switching to [next]. Sets CR0.TS
+ * unless [next] already has its state in the registers, so the first FPU
+ * instruction it runs traps and loads it.
+*/
+void fpu_switch_to(Thread *next);
+
+/**
+ * Forget the registers of a thread that is exiting.
+*/
+void fpu_thread_exit(Thread *thread);
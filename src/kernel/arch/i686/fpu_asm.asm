@@ -0,0 +1,35 @@
+[bits 32]
+
+; Clear CR0.TS so FPU and SSE instructions no longer raise #NM
+global fpu_clear_ts
+fpu_clear_ts:
+    clts
+    ret
+
+; void fpu_save(void *area);
+; area must be 16 byte aligned and FPU_STATE_SIZE bytes long
+global fpu_save
+fpu_save:
+    mov eax, [esp + 4]
+    fxsave [eax]
+    ret
+
+; void fpu_restore(const void *area);
+global fpu_restore
+fpu_restore:
+    mov eax, [esp + 4]
+    fxrstor [eax]
+    ret
+
+; Put the x87 control and status registers in their default state
+global fpu_reset
+fpu_reset:
+    fninit
+    ret
+
+; void fpu_load_mxcsr(uint32_t mxcsr);
+; Only valid when the CPU has SSE
+global fpu_load_mxcsr
+fpu_load_mxcsr:
+    ldmxcsr [esp + 4]
+    ret
@@ -1,5 +1,6 @@
 #include "gdt.h"
 #include <stdint.h>
+#include <task.h>
 
 typedef struct
 {
@@ -63,7 +64,7 @@ typedef enum {
     GDT_BASE_HIGH(base),                        \
 }
 
-GDT_Entry gdt[] = {
+GDT_Entry gdt[3 + MAX_CPUS] = {
     // Null descriptor
     GDT_ENTRY(0, 0, 0, 0),
 
@@ -80,6 +81,8 @@ GDT_Entry gdt[] = {
               GDT_ACCESS_PRESENT | GDT_ACCESS_RING0 | GDT_ACCESS_DATA_SEGMENT | GDT_ACCESS_DATA_WRITEABLE,
               GDT_FLAG_32BIT | GDT_FLAG_GRANULARITY_4K
     ),
+
+    // Followed by the per-CPU data segments, filled in by gdt_set_cpu_segment
 };
 
 GDT_Descriptor gdt_descriptor = { sizeof(gdt) - 1, gdt };
@@ -88,6 +91,23 @@ void __attribute__((cdecl)) gdt_load(
     GDT_Descriptor* descriptor, uint16_t code_segment, uint16_t data_segment
 );
 
+void __attribute__((cdecl)) gdt_load_gs(uint16_t segment);
+
 void gdt_initialize() {
     gdt_load(&gdt_descriptor, GDT_CODE_SEGMENT, GDT_DATA_SEGMENT);
 }
+
+void gdt_set_cpu_segment(int cpu, void *base, size_t size) {
+    GDT_Entry entry = GDT_ENTRY(
+        (uint32_t)base,
+        (uint32_t)(size - 1),
+        GDT_ACCESS_PRESENT | GDT_ACCESS_RING0 | GDT_ACCESS_DATA_SEGMENT | GDT_ACCESS_DATA_WRITEABLE,
+        GDT_FLAG_32BIT | GDT_FLAG_GRANULARITY_1B
+    );
+    gdt[GDT_CPU_SEGMENT(cpu) / 8] = entry;
+}
+
+void gdt_load_cpu(int cpu) {
+    gdt_load(&gdt_descriptor, GDT_CODE_SEGMENT, GDT_DATA_SEGMENT);
+    gdt_load_gs(GDT_CPU_SEGMENT(cpu));
+}
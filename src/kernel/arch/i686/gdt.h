@@ -1,6 +1,28 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define GDT_CODE_SEGMENT 0x08
 #define GDT_DATA_SEGMENT 0x10
 
+// Each CPU has a data segment covering its per-CPU data, loaded in gs
+#define GDT_CPU_SEGMENT(cpu) (0x18 + (cpu) * 8)
+
 void gdt_initialize();
+
+/**
+ * Point the per-CPU segment of [cpu] at [base].
+ * 
+ * Parameters:
+ *   cpu: The index of the CPU
+ *   base: The CPU's per-CPU data
+ *   size: The size of the per-CPU data
+*/
+void gdt_set_cpu_segment(int cpu, void *base, size_t size);
+
+/**
+ * Load the GDT on the calling CPU and load gs with the per-CPU segment of
+ * [cpu].
+*/
+void gdt_load_cpu(int cpu);
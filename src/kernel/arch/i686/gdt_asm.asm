@@ -33,3 +33,12 @@ gdt_load:
     mov esp, ebp
     pop ebp
     ret
+
+;
+; void gdt_load_gs(uint16_t segment);
+;
+global gdt_load_gs
+gdt_load_gs:
+    mov ax, [esp + 4]   ; Segment in arg[0]
+    mov gs, ax
+    ret
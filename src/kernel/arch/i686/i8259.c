@@ -1,6 +1,7 @@
 #include "i8259.h"
 #include "io.h"
 #include <stdbool.h>
+#include <stddef.h>
 
 static enum {
     PIC_PORT_CMD_1  = 0x20,
@@ -28,18 +29,64 @@ static enum {
 
 static enum {
     PIC_CMD_END_OF_INTERRUPT    = 0x20,
+    PIC_CMD_SPECIFIC_EOI        = 0x60,
     PIC_CMD_READ_IRR            = 0x0A,
     PIC_CMD_READ_ISR            = 0x0B,
 } PIC_CMD;
 
+#define PIC_CASCADE_IRQ 2
+
 static uint16_t pic_mask = 0xFFFF;
 
+// Set when the master acknowledges its interrupts as the CPU takes them.
+// The slave always needs an EOI, auto-EOI on a slave is not reliable.
+static bool master_auto_eoi = false;
+
+/**
+ * Write the masks to both PICs. Operation command words need no delay
+ * between them, unlike the initialization sequence.
+*/
 static void set_mask(uint16_t new_mask) {
     pic_mask = new_mask;
     out_byte(PIC_PORT_DATA_1, new_mask & 0xFF);
-    io_wait();
     out_byte(PIC_PORT_DATA_2, new_mask >> 8);
-    io_wait();
+}
+
+/**
+ * Change the mask of [irq], only writing to the PIC it belongs to and only
+ * when the cached mask shows it would change.
+*/
+static void update_mask(int irq, bool masked) {
+    uint16_t new_mask = masked ? pic_mask | (1 << irq) : pic_mask & ~(1 << irq);
+    if (new_mask == pic_mask) return;
+
+    pic_mask = new_mask;
+    if (irq < 8)
+        out_byte(PIC_PORT_DATA_1, new_mask & 0xFF);
+    else
+        out_byte(PIC_PORT_DATA_2, new_mask >> 8);
+}
+
+/**
+ * Specific EOIs clear the in-service bit of [irq] itself rather than the
+ * highest one, so they stay right however handlers nest.
+ * 
+ * Returns:
+ *   The EOI command for the slave, 0 if it needs none
+*/
+static uint8_t slave_eoi_command(int irq) {
+    if (irq < 8) return 0;
+    return PIC_CMD_SPECIFIC_EOI | (irq - 8);
+}
+
+/**
+ * Returns:
+ *   The EOI command for the master, 0 if it needs none. Interrupts from the
+ *   slave are in service on the master's cascade input.
+*/
+static uint8_t master_eoi_command(int irq) {
+    if (master_auto_eoi) return 0;
+    return PIC_CMD_SPECIFIC_EOI | (irq >= 8 ? PIC_CASCADE_IRQ : irq);
 }
 
 static uint16_t get_mask() {
@@ -69,12 +116,12 @@ static void configure(uint8_t offset_pic1, uint8_t offset_pic2, bool auto_eoi) {
     out_byte(PIC_PORT_DATA_2, 0x2);         // Tell PIC2 it's cascade identity (0000 0010)
     io_wait();
 
-    // Initialization control word 4
+    // Initialization control word 4. Only the master uses auto-EOI, with
+    // it the slave can lose interrupts on some chipsets.
     uint8_t icw4 = PIC_ICW4_8086;
-    if (auto_eoi)
-        icw4 |= PIC_ICW4_AUTO_EOI;
+    master_auto_eoi = auto_eoi;
 
-    out_byte(PIC_PORT_DATA_1, icw4);
+    out_byte(PIC_PORT_DATA_1, auto_eoi ? icw4 | PIC_ICW4_AUTO_EOI : icw4);
     io_wait();
     out_byte(PIC_PORT_DATA_2, icw4);
     io_wait();
@@ -90,9 +137,10 @@ static void configure(uint8_t offset_pic1, uint8_t offset_pic2, bool auto_eoi) {
 }
 
 static void send_eoi(int irq) {
-    if (irq >= 8)
-        out_byte(PIC_PORT_CMD_2, PIC_CMD_END_OF_INTERRUPT);
-    out_byte(PIC_PORT_CMD_1, PIC_CMD_END_OF_INTERRUPT);
+    uint8_t slave = slave_eoi_command(irq);
+    uint8_t master = master_eoi_command(irq);
+    if (slave != 0) out_byte(PIC_PORT_CMD_2, slave);
+    if (master != 0) out_byte(PIC_PORT_CMD_1, master);
 }
 
 static void disable() {
@@ -100,11 +148,14 @@ static void disable() {
 }
 
 static void mask(int irq) {
-    set_mask(pic_mask | (1 << irq));
+    update_mask(irq, true);
 }
 
 static void unmask(int irq) {
-    set_mask(pic_mask & ~(1 << irq));
+    update_mask(irq, false);
+
+    // The slave's interrupts only get through the cascade input
+    if (irq >= 8) update_mask(PIC_CASCADE_IRQ, false);
 }
 
 static uint16_t read_irr() {
@@ -119,6 +170,25 @@ static uint16_t read_isr() {
     return (in_byte(PIC_PORT_CMD_1) | (in_byte(PIC_PORT_CMD_2) << 8));
 }
 
+/**
+ * IRQ 7 and 15 are raised when a request goes away before the CPU takes
+ * it. The in-service bit is only set for real interrupts. A spurious IRQ 15
+ * still needs an EOI for the cascade on the master.
+ *
+ * With auto-EOI the master clears the in-service bit as the CPU takes the
+ * interrupt, so a spurious IRQ 7 can not be told apart. It is passed on to
+ * the handler, which finds its device has nothing to say.
+*/
+static bool is_spurious(int irq) {
+    if (irq != 7 && irq != 15) return false;
+    if (irq == 7 && master_auto_eoi) return false;
+    if (read_isr() & (1 << irq)) return false;
+
+    uint8_t master = master_eoi_command(irq);
+    if (master != 0) out_byte(PIC_PORT_CMD_1, master);
+    return true;
+}
+
 static bool probe() {
     disable();
 
@@ -127,6 +197,12 @@ static bool probe() {
     return get_mask() == 0x1337;
 }
 
+static void fast_eoi(int irq, ISR_FastEOI *eoi) {
+    eoi->reg = NULL;
+    eoi->slave_command = slave_eoi_command(irq);
+    eoi->master_command = master_eoi_command(irq);
+}
+
 static const PIC_Driver driver = {
     .name = "8259 PIC",
     .probe = &probe,
@@ -134,7 +210,9 @@ static const PIC_Driver driver = {
     .disable = &disable,
     .send_eoi = &send_eoi,
     .mask = &mask,
-    .unmask = &unmask
+    .unmask = &unmask,
+    .is_spurious = &is_spurious,
+    .fast_eoi = &fast_eoi
 };
 
 const PIC_Driver* i8259_get_driver() {
@@ -2,8 +2,13 @@
 
 #include <arch/i686/io.h>
 #include <arch/i686/pci.h>
+#include <debug.h>
+#include <timer.h>
 #include <stdio.h>
 
+// How long to wait for a drive to become ready or send data
+#define IDE_TIMEOUT_MS 1000
+
 typedef enum {
     ATA_SR_BSY    = 0x80,    // Busy
     ATA_SR_RDY   = 0x40,    // Drive ready
@@ -111,23 +116,35 @@ static void select_device(ATA_Drive *drive) {
     }
 }
 
-static void wait_dev_nbsy(ATA_Drive *drive) {
+/**
+ * Wait for [drive] to clear its busy flag.
+ * 
+ * Returns:
+ *   Whether the drive became ready before IDE_TIMEOUT_MS
+*/
+static bool wait_dev_nbsy(ATA_Drive *drive) {
+    Timeout timeout;
+    timeout_start(&timeout, IDE_TIMEOUT_MS);
+
     uint8_t status;
     do {
         status = in_byte(channels[drive->channel].ctrl + ATA_REG_ALTSTATUS);
-    } while(((status & ATA_SR_BSY) != 0));
+        if ((status & ATA_SR_BSY) == 0) return true;
+    } while(!timeout_expired(&timeout));
+
+    return false;
 }
 
 static int read_sectors(
     uint8_t sectors, uint32_t lba, void *buffer, ATA_Drive *drive
 ) {
     if (!drive->present) {
-        printf("ERROR: Invalid drive\n");
+        log_error("IDE", "Invalid drive");
         return 0;
     }
 
     if (lba > 0x0FFFFFFF) {
-        printf("ERROR: LBA %d too high for 28 bit addressing\n");
+        log_error("IDE", "LBA %d too high for 28 bit addressing", lba);
         return 0;
     }
 
@@ -139,17 +156,24 @@ static int read_sectors(
     out_byte(base + ATA_REG_LBA0, lba);
     out_byte(base + ATA_REG_LBA1, lba >> 8);
     out_byte(base + ATA_REG_LBA2, lba >> 16);
-    wait_dev_nbsy(drive);
+    if (!wait_dev_nbsy(drive)) {
+        log_error("IDE", "Timed out waiting for drive %d", drive->drive);
+        return 0;
+    }
     out_byte(base + ATA_REG_COMMAND, ATA_CMD_READ_PIO);
 
     // Read in the sectors
     uint16_t *u16_buff = (uint16_t *)buffer;
     for (int s=0; s<sectors; s++) {
+        Timeout timeout;
+        timeout_start(&timeout, IDE_TIMEOUT_MS);
+
         // Wait for status to indicate ready or error
         uint8_t status = in_byte(ctrl + ATA_REG_ALTSTATUS);
         while (
             ((status & ATA_SR_BSY) || !(status & ATA_SR_DRQ)) &&
-            !(status & ATA_SR_ERR) && !(status & ATA_SR_DF)
+            !(status & ATA_SR_ERR) && !(status & ATA_SR_DF) &&
+            !timeout_expired(&timeout)
         )
             status = in_byte(ctrl + ATA_REG_ALTSTATUS);
 
@@ -158,6 +182,11 @@ static int read_sectors(
             return s;
         }
 
+        if ((status & ATA_SR_BSY) || !(status & ATA_SR_DRQ)) {
+            log_error("IDE", "Timed out reading LBA %d", lba + s);
+            return s;
+        }
+
         // Read in the sector
         for (int i=0; i<256; i++) {
             u16_buff[i] = in_word(base + ATA_REG_DATA);
@@ -206,10 +235,10 @@ static void initialize_drive(ATA_Drive *drive) {
     uint8_t status = in_byte(ctrl + ATA_REG_ALTSTATUS);
     if (status == 0) return;
 
-    drive->present = true;
-
     // Poll until not busy
-    while (status & ATA_SR_BSY) status = in_byte(ctrl + ATA_REG_ALTSTATUS);
+    if (!wait_dev_nbsy(drive)) return;
+
+    drive->present = true;
 
 
     // Determine drive type
@@ -230,11 +259,16 @@ static void initialize_drive(ATA_Drive *drive) {
     }
 
     // Poll until data ready
-    while (!(status & ATA_SR_DRQ) && !(status & ATA_SR_ERR)) 
+    Timeout timeout;
+    timeout_start(&timeout, IDE_TIMEOUT_MS);
+    status = in_byte(ctrl + ATA_REG_ALTSTATUS);
+    while (!(status & ATA_SR_DRQ) && !(status & ATA_SR_ERR) && 
+        !timeout_expired(&timeout)
+    )
         status = in_byte(ctrl + ATA_REG_ALTSTATUS);
 
-    // Error set
-    if (status & ATA_SR_ERR) return;
+    // Error set or the identify data never came
+    if ((status & ATA_SR_ERR) || !(status & ATA_SR_DRQ)) return;
 
     // Read in the packet
     for (int i = 0; (status & ATA_SR_DRQ) && (i < 512); i+=2) {
@@ -306,7 +340,7 @@ static void initialize_drives() {
 
     for (int i=0; i<4; i++) {
         if (drives[i].present) {
-            printf("  Found %s Drive %lldMB - %s\n", 
+            log_info("IDE", "Found %s Drive %lldMB - %s", 
                 (const char *[]){"PATA", "PATAPI", "SATAPI", "SATA", "UNKOWN"}[drives[i].type],
                 drives[i].size / 2 / 1024,
                 drives[i].model
@@ -323,10 +357,40 @@ ATA_Drive * ide_get_drive(int drive) {
 void ide_initialize(PCI_Device *dev) {
     if (dev->class_code != 0x01 || dev->subclass_code != 0x01) return;
 
-    printf("  Initializing IDE Device\n");
+    log_info("IDE", "Initializing IDE Device");
 
     initialize_channels(dev);
     initialize_drives();
 
-    printf("  Initialized IDE Device\n");
+    log_info("IDE", "Initialized IDE Device");
+}
+
+// Set once a controller has been taken. The drive state is shared, so only
+// the first controller is driven.
+static bool claimed = false;
+
+static bool probe(PCI_Device *dev) {
+    // Other controllers may be probed at the same time on other CPUs
+    if (__atomic_exchange_n(&claimed, true, __ATOMIC_ACQ_REL)) return false;
+
+    ide_initialize(dev);
+    return true;
+}
+
+static const PCI_DeviceId ide_ids[] = {
+    PCI_DEVICE_CLASS(0x01, 0x01),
+    PCI_DEVICE_END
+};
+
+// Identifying the drives polls with timeouts, so let it overlap with other
+// probes. probe only takes the first controller, so its state is not shared.
+static const PCI_Driver driver = {
+    .name = "IDE",
+    .ids = ide_ids,
+    .probe = &probe,
+    .parallel = true
+};
+
+const PCI_Driver* ide_get_pci_driver() {
+    return &driver;
 }
\ No newline at end of file
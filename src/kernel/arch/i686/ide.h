@@ -22,4 +22,10 @@ typedef struct {
 } ATA_Drive;
 
 void ide_initialize(PCI_Device *dev);
+
+/**
+ * Returns:
+ *   The driver for IDE controllers, to register with pci_register_driver
+*/
+const PCI_Driver* ide_get_pci_driver();
 ATA_Drive * ide_get_drive(int drive);
\ No newline at end of file
@@ -5,6 +5,8 @@
 
 void ASMCALL disable_interrupts();
 void ASMCALL enable_interrupts();
+uint32_t ASMCALL save_and_disable_interrupts();
+void ASMCALL restore_interrupts(uint32_t flags);
 void ASMCALL out_byte(uint16_t port, uint8_t value);
 uint8_t ASMCALL in_byte(uint16_t port);
 void ASMCALL out_word(uint16_t port, uint32_t value);
@@ -13,5 +15,12 @@ void ASMCALL out_double(uint16_t port, uint32_t value);
 uint32_t ASMCALL in_double(uint16_t port);
 
 void ASMCALL io_wait();
+uint64_t ASMCALL read_tsc();
 void ASMCALL panic_stop();
-void ASMCALL halt();
\ No newline at end of file
+void ASMCALL halt();
+void ASMCALL enable_interrupts_and_halt();
+void ASMCALL cpu_relax();
+uint32_t ASMCALL read_cr0();
+void ASMCALL write_cr0(uint32_t value);
+uint32_t ASMCALL read_cr4();
+void ASMCALL write_cr4(uint32_t value);
\ No newline at end of file
@@ -51,6 +51,11 @@ io_wait:
     out dx, al
     ret
 
+global read_tsc
+read_tsc:
+    rdtsc           ; Result in edx:eax which is how a uint64_t is returned
+    ret
+
 global disable_interrupts
 disable_interrupts:
     cli
@@ -61,6 +66,21 @@ enable_interrupts:
     sti
     ret
 
+; Returns the old eflags so restore_interrupts can put IF back how it was
+global save_and_disable_interrupts
+save_and_disable_interrupts:
+    pushfd
+    pop eax
+    cli
+    ret
+
+global restore_interrupts
+restore_interrupts:
+    mov eax, [esp + 4]
+    push eax
+    popfd
+    ret
+
 global panic_stop
 panic_stop:
     cli
@@ -69,4 +89,39 @@ panic_stop:
 global halt
 halt:
     hlt
-    ret
\ No newline at end of file
+    ret
+
+; Enable interrupts and halt until the next one. sti only takes effect after
+; the following instruction, so an interrupt can not slip in before the hlt.
+global enable_interrupts_and_halt
+enable_interrupts_and_halt:
+    sti
+    hlt
+    ret
+
+; Hint to the CPU that this is a spin-wait loop
+global cpu_relax
+cpu_relax:
+    pause
+    ret
+global read_cr0
+read_cr0:
+    mov eax, cr0
+    ret
+
+global write_cr0
+write_cr0:
+    mov eax, [esp + 4]
+    mov cr0, eax
+    ret
+
+global read_cr4
+read_cr4:
+    mov eax, cr4
+    ret
+
+global write_cr4
+write_cr4:
+    mov eax, [esp + 4]
+    mov cr4, eax
+    ret
@@ -1,33 +1,117 @@
 #include "irq.h"
 #include "pic.h"
+#include "apic.h"
 #include "i8259.h"
 #include "io.h"
+#include "smp.h"
+#include "spinlock.h"
+#include <debug.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <tasklet.h>
+#include <thread.h>
 
 #define SIZE(array) (sizeof(array) / sizeof(array[0]))
 
 #define PIC_REMAP_OFFSET    0x20
 
+// Let the 8259 acknowledge interrupts itself as the CPU takes them. Top
+// halves run with interrupts disabled, so they still can not nest even
+// though the PIC no longer holds back lower priorities. The APIC ignores it.
+#define PIC_AUTO_EOI        true
+
 IRQHandler irq_handlers[16];
 static const PIC_Driver* driver = NULL;
 
+static IRQStats irq_stats[16];
+static int depth[MAX_CPUS];     // Interrupt handlers running on each CPU
+
+static IRQHandler msi_handlers[IRQ_MSI_VECTOR_COUNT];
+static Spinlock msi_lock = SPINLOCK_INIT;
+
+/**
+ * Run the bottom halves, which only run on the boot processor, then leave
+ * the handler. Called after the interrupt has been acknowledged.
+*/
+static void finish_handler(int cpu) {
+    // Interrupts that arrive meanwhile only run their top halves and leave
+    // the rest to this loop
+    if (depth[cpu] == 1 && cpu == 0) tasklet_run_pending();
+    depth[cpu]--;
+}
+
+/**
+ * Dispatch a message signaled interrupt. These always come through the
+ * local APIC, on whichever CPU the device was told to target.
+*/
+static void msi_handler(Registers *regs) {
+    int cpu = smp_cpu_id();
+    depth[cpu]++;
+
+    IRQHandler handler = msi_handlers[regs->interrupt - IRQ_MSI_VECTOR_BASE];
+    if (handler != NULL) handler(regs);
+
+    apic_eoi();
+    finish_handler(cpu);
+}
+
 void irq_handler(Registers *regs) {
+    uint64_t start = read_tsc();
     int irq = regs->interrupt - PIC_REMAP_OFFSET;
 
+    // Noise on the line can make the PIC raise its lowest priority IRQ
+    // without a device asking for it. It must not be acknowledged.
+    if (driver->is_spurious != NULL && driver->is_spurious(irq)) {
+        irq_stats[irq].spurious++;
+        return;
+    }
+
+    int cpu = smp_cpu_id();
+    depth[cpu]++;
+
     if (irq_handlers[irq] != NULL) {
         irq_handlers[irq](regs);
     } 
     else {
-        printf("Unhandled IRQ %d\n", irq);
+        log_warn("IRQ", "Unhandled IRQ %d", irq);
     }
 
     driver->send_eoi(irq);
+
+    uint64_t cycles = read_tsc() - start;
+    IRQStats *stats = &irq_stats[irq];
+    stats->count++;
+    stats->total_off_cycles += cycles;
+    if (cycles > stats->max_off_cycles) stats->max_off_cycles = cycles;
+
+    finish_handler(cpu);
+}
+
+void irq_exit() {
+    // Switch threads if the tick used up the time slice or woke a thread
+    // with a higher priority. Threads only run on the boot processor.
+    int cpu = smp_cpu_id();
+    if (depth[cpu] == 0 && cpu == 0) thread_preempt();
+}
+
+bool irq_in_handler() {
+    return depth[smp_cpu_id()] > 0;
+}
+
+void irq_fast_exit() {
+    int cpu = smp_cpu_id();
+    if (depth[cpu] == 0) {
+        depth[cpu]++;
+        finish_handler(cpu);
+    }
+    irq_exit();
 }
 
 void irq_initialize() {
+    // Later drivers are preferred when more than one is present
     const PIC_Driver* drivers[] = {
         i8259_get_driver(),
+        apic_get_driver(),
     };
 
     for (int i=0; i<SIZE(drivers); i++) {
@@ -37,12 +121,12 @@ void irq_initialize() {
     }
 
     if (driver == NULL) {
-        printf("Warning: No PIC found!");
+        log_warn("IRQ", "No PIC found!");
         return;
     }
 
-    printf("Using PIC Driver: %s\n", driver->name);
-    driver->initialize(PIC_REMAP_OFFSET, PIC_REMAP_OFFSET + 8, false);
+    log_info("IRQ", "Using PIC Driver: %s", driver->name);
+    driver->initialize(PIC_REMAP_OFFSET, PIC_REMAP_OFFSET + 8, PIC_AUTO_EOI);
 
     for (int i=0; i<16; i++)
         isr_register_handler(PIC_REMAP_OFFSET + i, irq_handler);
@@ -52,3 +136,48 @@ void irq_register_handler(int irq, IRQHandler handler) {
     irq_handlers[irq] = handler;
     driver->unmask(irq);
 }
+
+bool irq_register_fast_handler(int irq, ISR_FastHandler handler) {
+    if (driver == NULL || driver->fast_eoi == NULL) return false;
+
+    // Only the slow path can check whether these were spurious
+    if (driver->is_spurious != NULL && (irq == 7 || irq == 15)) return false;
+
+    ISR_FastEOI eoi;
+    driver->fast_eoi(irq, &eoi);
+    isr_register_fast_handler(PIC_REMAP_OFFSET + irq, handler, &eoi);
+    driver->unmask(irq);
+    return true;
+}
+
+int irq_allocate_vector(IRQHandler handler) {
+    if (!apic_enabled()) return -1;
+
+    uint32_t flags = spin_lock_irqsave(&msi_lock);
+    int vector = -1;
+    for (int i = 0; i < IRQ_MSI_VECTOR_COUNT; i++) {
+        if (msi_handlers[i] == NULL) {
+            msi_handlers[i] = handler;
+            vector = IRQ_MSI_VECTOR_BASE + i;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&msi_lock, flags);
+
+    if (vector >= 0) isr_register_handler(vector, msi_handler);
+    return vector;
+}
+
+void irq_free_vector(int vector) {
+    if (vector < IRQ_MSI_VECTOR_BASE) return;
+    if (vector >= IRQ_MSI_VECTOR_BASE + IRQ_MSI_VECTOR_COUNT) return;
+
+    isr_register_handler(vector, NULL);
+    msi_handlers[vector - IRQ_MSI_VECTOR_BASE] = NULL;
+}
+
+void irq_get_stats(int irq, IRQStats *stats) {
+    uint32_t flags = save_and_disable_interrupts();
+    *stats = irq_stats[irq];
+    restore_interrupts(flags);
+}
@@ -4,5 +4,75 @@
 
 typedef void (*IRQHandler)(Registers* regs);
 
+// Vectors handed out for message signaled interrupts, above the legacy IRQs
+// and below the vectors used by the local APIC itself
+#define IRQ_MSI_VECTOR_BASE     0x30
+#define IRQ_MSI_VECTOR_COUNT    0xC0
+
+typedef struct {
+    uint32_t count;
+    uint64_t total_off_cycles;  // TSC cycles run with interrupts disabled
+    uint64_t max_off_cycles;
+    uint32_t spurious;          // Interrupts the PIC raised with no source
+} IRQStats;
+
 void irq_initialize();
 void irq_register_handler(int irq, IRQHandler handler);
+
+/**
+ * Handle [irq] through a fast path stub instead of irq_handler. The stub
+ * skips the spurious check and the interrupts-off stats, and sends the EOI
+ * itself. Meant for high rate sources such as the timer.
+ * 
+ * Parameters:
+ *   irq: The legacy IRQ
+ *   handler: The function to call
+ * 
+ * Returns:
+ *   Whether the fast path could be used. When it can not, the caller should
+ *   fall back to irq_register_handler.
+*/
+bool irq_register_fast_handler(int irq, ISR_FastHandler handler);
+
+/**
+ * Called on the way out of a fast path handler that asked for it. Runs the
+ * tasklets and switches threads like the end of irq_handler.
+*/
+void irq_fast_exit();
+
+/**
+ * Called on the way out of every interrupt. Switches threads if the
+ * interrupt made that necessary and no other handler is still running.
+*/
+void irq_exit();
+
+/**
+ * Returns:
+ *   Whether the current CPU is running an IRQ handler or the tasklets run
+ *   on the way out of one
+*/
+bool irq_in_handler();
+
+/**
+ * Get how often [irq] has fired and how long its top half kept interrupts
+ * disabled, from entering the handler to sending the EOI.
+*/
+void irq_get_stats(int irq, IRQStats *stats);
+
+/**
+ * Reserve an interrupt vector for a message signaled interrupt. The handler
+ * is called with the vector in regs->interrupt and the interrupt is
+ * acknowledged after it returns. Needs the APIC driver.
+ * 
+ * Parameters:
+ *   handler: The function to call when the vector is raised
+ * 
+ * Returns:
+ *   The vector, or -1 if there is none free or the APIC is not in use
+*/
+int irq_allocate_vector(IRQHandler handler);
+
+/**
+ * Release a vector returned by irq_allocate_vector.
+*/
+void irq_free_vector(int vector);
@@ -2,10 +2,28 @@
 #include "idt.h"
 #include "gdt.h"
 #include "io.h"
+#include "irq.h"
+#include <debug.h>
 #include <stddef.h>
 #include <stdio.h>
 
+// Read by isr_fast_common, which depends on this layout
+typedef struct {
+    ISR_FastHandler handler;
+    volatile uint32_t *eoi_register;
+    uint32_t count;
+    uint8_t slave_command;
+    uint8_t master_command;
+    uint8_t reserved[2];
+} ISR_FastSlot;
+
+_Static_assert(sizeof(ISR_FastSlot) == 16, "isr_fast_common indexes by 16");
+
 static ISR_Handler isr_handlers[256];
+static ISR_Stats isr_stats[256];
+
+ISR_FastSlot isr_fast_slots[256];
+extern uint8_t isr_fast_stubs[];
 
 static const char* const exception_names[] = {
     "Divide by zero error",
@@ -49,12 +67,29 @@ void isr_initialize() {
         idt_enable_gate(i);
 }
 
+static void record_time(int interrupt, uint64_t cycles) {
+    ISR_Stats *stats = &isr_stats[interrupt];
+    stats->count++;
+    stats->total_cycles += cycles;
+    if (cycles > stats->max_cycles) stats->max_cycles = cycles;
+
+    int bucket = 0;
+    while (bucket < ISR_HISTOGRAM_BUCKETS - 1 && (cycles >> (bucket + 1)) != 0)
+        bucket++;
+    stats->histogram[bucket]++;
+}
+
 void __attribute__((cdecl)) isr_handler_common(Registers *regs) {
+    uint64_t entry = read_tsc();
+
     if (isr_handlers[regs->interrupt] != NULL)
         isr_handlers[regs->interrupt](regs);
     else if (regs->interrupt >= 32)
         printf("Unhandled interrupt %d!\n", regs->interrupt);
     else {
+        // Show what was logged leading up to the exception
+        log_render();
+
         printf("Unhandled exception %d %s\n", regs->interrupt, exception_names[regs->interrupt]);
 
         printf("  eax=%x  ebx=%x  ecx=%x  edx=%x  esi=%x  edi=%x\n",
@@ -66,8 +101,15 @@ void __attribute__((cdecl)) isr_handler_common(Registers *regs) {
         printf("  interrupt=%x  errorcode=%x\n", regs->interrupt, regs->error);
 
         printf("KERNEL PANIC!\n");
+        fflush(stdout);
         panic_stop();
     }
+
+    record_time(regs->interrupt, read_tsc() - entry);
+
+    // Only switch threads once the handler's time has been recorded, so it
+    // does not include the time other threads ran for
+    if (regs->interrupt >= 32) irq_exit();
 }
 
 void isr_register_handler(int interrupt, ISR_Handler handler)
@@ -75,3 +117,33 @@ void isr_register_handler(int interrupt, ISR_Handler handler)
     isr_handlers[interrupt] = handler;
     idt_enable_gate(interrupt);
 }
+
+void isr_register_fast_handler(
+    int interrupt, ISR_FastHandler handler, const ISR_FastEOI *eoi
+) {
+    if (interrupt < 32 || interrupt > 255) return;
+
+    ISR_FastSlot *slot = &isr_fast_slots[interrupt];
+    slot->handler = handler;
+    slot->eoi_register = eoi->reg;
+    slot->slave_command = eoi->slave_command;
+    slot->master_command = eoi->master_command;
+
+    idt_set_gate(interrupt, isr_fast_stubs + interrupt * ISR_FAST_STUB_SIZE,
+        GDT_CODE_SEGMENT, IDT_FLAG_RING0 | IDT_FLAG_GATE_32BIT_INT);
+    idt_enable_gate(interrupt);
+}
+
+/**
+ * Called by isr_fast_common after the EOI when the handler asked for it.
+*/
+void __attribute__((cdecl)) isr_fast_exit() {
+    irq_fast_exit();
+}
+
+void isr_get_stats(int interrupt, ISR_Stats *stats) {
+    uint32_t flags = save_and_disable_interrupts();
+    *stats = isr_stats[interrupt];
+    stats->count += isr_fast_slots[interrupt].count;
+    restore_interrupts(flags);
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <stdbool.h>
 #include <stdint.h>
 
 typedef struct
@@ -11,5 +12,60 @@ typedef struct
 
 typedef void (*ISR_Handler)(Registers *regs);
 
+/**
+ * A handler called straight from a fast path stub, which only saves the
+ * registers the C calling convention lets it clobber. It runs with
+ * interrupts disabled and the interrupt is acknowledged after it returns.
+ * 
+ * Returns:
+ *   Whether the handler may have made work for the interrupt exit, such as
+ *   waking a thread or scheduling a tasklet
+*/
+typedef bool (*ISR_FastHandler)(int interrupt);
+
+// Size of each fast path entry stub in isr_asm.asm
+#define ISR_FAST_STUB_SIZE 16
+
+/**
+ * How a fast path stub acknowledges its interrupt without calling into the
+ * PIC driver.
+*/
+typedef struct {
+    volatile uint32_t *reg;     // Written with 0 to acknowledge, or NULL
+    uint8_t slave_command;      // EOI command for the slave 8259, 0 for none
+    uint8_t master_command;     // EOI command for the master 8259, 0 for none
+} ISR_FastEOI;
+
+// Number of buckets in the handler time histograms. Bucket n counts handlers
+// that took from 2^n up to 2^(n+1) cycles, the last one everything longer.
+#define ISR_HISTOGRAM_BUCKETS 24
+
+typedef struct {
+    uint32_t count;
+    uint64_t total_cycles;      // TSC cycles from entry to exit of the handler
+    uint64_t max_cycles;
+    uint32_t histogram[ISR_HISTOGRAM_BUCKETS];
+} ISR_Stats;
+
 void isr_initialize();
 void isr_register_handler(int interrupt, ISR_Handler handler);
+
+/**
+ * Point the gate for [interrupt] at a fast path stub that calls [handler]
+ * directly and then acknowledges the interrupt as [eoi] describes. Only the
+ * count of a fast vector is recorded in its stats.
+ * 
+ * Parameters:
+ *   interrupt: The vector, from 32 up
+ *   handler: The function to call
+ *   eoi: How to acknowledge the interrupt
+*/
+void isr_register_fast_handler(
+    int interrupt, ISR_FastHandler handler, const ISR_FastEOI *eoi
+);
+
+/**
+ * Get how often [interrupt] has been handled and how long its handlers took,
+ * including bottom halves run on the way out.
+*/
+void isr_get_stats(int interrupt, ISR_Stats *stats);
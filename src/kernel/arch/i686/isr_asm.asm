@@ -1,6 +1,8 @@
 [bits 32]
 
 extern isr_handler_common
+extern isr_fast_slots
+extern isr_fast_exit
 
 %macro ISR_NOERRORCODE 1
 
@@ -31,11 +33,9 @@ isr_common:
     mov ax, ds
     push eax
 
-    mov ax, 0x10    ; Use kernel data segment
-    mov ds, ax
+    mov ax, 0x10    ; Use kernel data segment. gs is left alone since it
+    mov ds, ax      ; points at the per-CPU data.
     mov es, ax
-    mov fs, ax
-    mov gs, ax
 
     push esp        ; Pass pointer to stack to C
     call isr_handler_common
@@ -44,9 +44,69 @@ isr_common:
     pop eax         ; Restore old segment
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
 
     popa            ; Restore all registers
     add esp, 8      ; Remove error code and interrupt number
     iret
+
+; Fast path stubs, ISR_FAST_STUB_SIZE bytes apart so the stub for a vector
+; can be found without a table
+ISR_FAST_STUB_SIZE equ 16
+
+global isr_fast_stubs
+align ISR_FAST_STUB_SIZE
+isr_fast_stubs:
+%assign vector 0
+%rep 256
+    align ISR_FAST_STUB_SIZE
+    push eax
+    mov eax, vector
+    jmp near isr_fast_common
+%assign vector vector + 1
+%endrep
+
+; Only the registers a C function may clobber are saved, and ds and es are
+; left alone since nothing runs outside the kernel data segment
+isr_fast_common:
+    push ecx
+    push edx
+
+    mov ecx, eax
+    shl ecx, 4                              ; Offset of the vector's slot
+    inc dword [isr_fast_slots + ecx + 8]    ; Count the interrupt
+
+    push ecx
+    push eax                                ; Pass the vector to the handler
+    call [isr_fast_slots + ecx]
+    add esp, 4
+    pop ecx
+    mov edx, eax                            ; Whether exit work is needed
+
+    ; Acknowledge the interrupt here instead of through the PIC driver
+    mov eax, [isr_fast_slots + ecx + 4]
+    test eax, eax
+    jz .pic
+    mov dword [eax], 0                      ; Local APIC EOI register
+    jmp .exit
+
+.pic:
+    mov al, [isr_fast_slots + ecx + 12]     ; Slave 8259 EOI command
+    test al, al
+    jz .master
+    out 0xA0, al
+.master:
+    mov al, [isr_fast_slots + ecx + 13]     ; Master 8259 EOI command
+    test al, al
+    jz .exit
+    out 0x20, al
+
+.exit:
+    test dl, dl
+    jz .done
+    call isr_fast_exit
+
+.done:
+    pop edx
+    pop ecx
+    pop eax
+    iret
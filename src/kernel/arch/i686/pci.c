@@ -1,12 +1,14 @@
 #include "pci.h"
 
-#include <arch/i686/ide.h>
+#include <arch/i686/acpi.h>
 #include <arch/i686/io.h>
+#include <arch/i686/smp.h>
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <task.h>
 #include <util/list.h>
 
 static enum {
@@ -27,55 +29,155 @@ static enum {
     LATENCY_TIME = 0xD,
     HEADER_TYPE = 0xE,
     BIST = 0xF,
-    SECONDARY_BUS = 0x1A
+    BAR0 = 0x10,
+    SECONDARY_BUS = 0x19,
+    CAPABILITIES = 0x34
 } RegisterOffsets;
 
+static enum {
+    COMMAND_IO_SPACE = 0x1,
+    COMMAND_MEMORY_SPACE = 0x2,
+    COMMAND_BUS_MASTER = 0x4,
+    COMMAND_INTERRUPT_DISABLE = 0x400,
+
+    STATUS_CAPABILITIES = 0x10
+} CommandBits;
+
+static enum {
+    MSI_CONTROL_ENABLE = 0x1,
+    MSI_CONTROL_MULTIPLE_ENABLE = 0x70,
+    MSI_CONTROL_64BIT = 0x80,
+
+    MSIX_CONTROL_TABLE_SIZE = 0x7FF,
+    MSIX_CONTROL_FUNCTION_MASK = 0x4000,
+    MSIX_CONTROL_ENABLE = 0x8000,
+    MSIX_TABLE_BIR = 0x7,
+    MSIX_ENTRY_MASKED = 0x1,
+
+    BAR_IO = 0x1,
+
+    // Writes to this window are delivered to a local APIC as interrupts
+    MSI_ADDRESS_BASE = 0xFEE00000
+} MSIBits;
+
+typedef struct {
+    uint32_t address_low;
+    uint32_t address_high;
+    uint32_t data;
+    uint32_t control;
+} MSIX_Entry;
+
 static bool config_method_1;
 
+// The memory mapped configuration space, NULL to use the legacy ports
+static volatile uint8_t *ecam_base = NULL;
+static uint8_t ecam_start_bus = 0;
+static uint8_t ecam_end_bus = 0;
+
+static const PCI_Driver *drivers[PCI_MAX_DRIVERS];
+static int driver_count = 0;
+
 static void scan_bus(uint8_t bus);
 
 ListNode *device_list = NULL;
 
-static uint32_t config_read_reg(
+static uint32_t config_address(
     uint8_t bus, uint8_t device, uint8_t func, uint8_t offset
 ) {
-    uint32_t address;
     uint32_t lbus = bus;
     uint32_t ldevice = device;
     uint32_t lfunc = func;
 
-    address = (lbus << 16) | (ldevice << 11) | (lfunc << 8) | (offset & 0xFC) |
+    return (lbus << 16) | (ldevice << 11) | (lfunc << 8) | (offset & 0xFC) |
         0x80000000;
+}
+
+/**
+ * Returns:
+ *   The dword holding [offset] in the memory mapped configuration space, or
+ *   NULL if [bus] is not covered by it
+*/
+static volatile uint32_t *ecam_address(
+    uint8_t bus, uint8_t device, uint8_t func, uint8_t offset
+) {
+    if (ecam_base == NULL || bus < ecam_start_bus || bus > ecam_end_bus)
+        return NULL;
+
+    uint32_t address = ((uint32_t)(bus - ecam_start_bus) << 20) |
+        ((uint32_t)device << 15) | ((uint32_t)func << 12) | (offset & 0xFC);
+    return (volatile uint32_t *)(ecam_base + address);
+}
 
-    out_double(PORT_CONFIG_ADDR, address);
-    
-    int temp = in_double(PORT_CONFIG_DATA);
+static uint32_t config_read_reg(
+    uint8_t bus, uint8_t device, uint8_t func, uint8_t offset
+) {
+    uint32_t temp;
+    volatile uint32_t *ecam = ecam_address(bus, device, func, offset);
+    if (ecam != NULL) {
+        temp = *ecam;
+    } else {
+        out_double(PORT_CONFIG_ADDR, config_address(bus, device, func, offset));
+        temp = in_double(PORT_CONFIG_DATA);
+    }
     return temp >> ((offset & 0x3) * 8);
 }
 
-static void check_function(uint8_t bus, uint8_t device, uint8_t function) {
-    uint8_t class = config_read_reg(bus, device, function, CLASS);
-    uint8_t subclass = config_read_reg(bus, device, function, SUBCLASS);
-    
-    if (class == 0x6 && subclass == 0x4) {
-        uint8_t bus2 = config_read_reg(bus, device, function, SECONDARY_BUS);
-        scan_bus(bus2);
+static void config_write_reg(
+    uint8_t bus, uint8_t device, uint8_t func, uint8_t offset, uint32_t value
+) {
+    volatile uint32_t *ecam = ecam_address(bus, device, func, offset);
+    if (ecam != NULL) {
+        *ecam = value;
+        return;
     }
 
+    out_double(PORT_CONFIG_ADDR, config_address(bus, device, func, offset));
+    out_double(PORT_CONFIG_DATA, value);
+}
+
+/**
+ * Add the function to the device list, reading its whole header once and
+ * taking every field from that copy.
+ * 
+ * Returns:
+ *   The header type of the function
+*/
+static uint8_t check_function(uint8_t bus, uint8_t device, uint8_t function) {
     PCI_Device *new_dev = malloc(sizeof(PCI_Device));
     if (new_dev == NULL) panic("PCI", "Could not allocate memory for device!");
 
+    for (int i = 0; i < PCI_HEADER_DWORDS; i++)
+        new_dev->header[i] = config_read_reg(bus, device, function, i * 4);
+
+    uint32_t ids = new_dev->header[VENDOR_ID / 4];
+    uint32_t class_dword = new_dev->header[CLASS / 4];
+    uint8_t class = class_dword >> 24;
+    uint8_t subclass = class_dword >> 16;
+
     new_dev->bus = bus;
     new_dev->device = device;
     new_dev->func = function;
     new_dev->class_code = class;
     new_dev->subclass_code = subclass;
+    new_dev->vendor_id = ids & 0xFFFF;
+    new_dev->device_id = ids >> 16;
+    new_dev->msi_cap = pci_dev_find_capability(new_dev, PCI_CAP_MSI);
+    new_dev->msix_cap = pci_dev_find_capability(new_dev, PCI_CAP_MSIX);
+    new_dev->driver = NULL;
 
     list_add_head(&device_list, new_dev);
 
-    printf("  PCI Device [bus=%#x, dev=%#x, func=%#x, class=%#x, subclass=%#x]\n",
-        bus, device, function, class, subclass
+    log_info("PCI", "PCI Device [bus=%#x, dev=%#x, func=%#x, class=%#x, subclass=%#x]%s%s",
+        bus, device, function, class, subclass,
+        new_dev->msi_cap ? " MSI" : "", new_dev->msix_cap ? " MSI-X" : ""
     );
+
+    if (class == 0x6 && subclass == 0x4) {
+        uint8_t bus2 = new_dev->header[SECONDARY_BUS / 4] >> (SECONDARY_BUS % 4) * 8;
+        scan_bus(bus2);
+    }
+
+    return new_dev->header[HEADER_TYPE / 4] >> 16;
 }
 
 static void scan_device(uint8_t bus, uint8_t device) {
@@ -85,8 +187,7 @@ static void scan_device(uint8_t bus, uint8_t device) {
 
     vendor_id = config_read_reg(bus, device, function, VENDOR_ID);
     if (vendor_id == 0xFFFF) return;
-    check_function(bus, device, function);
-    header_type = config_read_reg(bus, device, function, HEADER_TYPE);
+    header_type = check_function(bus, device, function);
     if ((header_type & 0x80) != 0) {
         for (function = 1; function < 8; function++) {
             vendor_id = config_read_reg(bus, device, function, VENDOR_ID);
@@ -103,26 +204,238 @@ static void scan_bus(uint8_t bus) {
     }
 }
 
+/**
+ * Returns:
+ *   Whether the dword at [reg] can be read from the copy of the header. The
+ *   device changes the status and BIST registers on its own.
+*/
+static bool is_cached(uint8_t reg) {
+    int index = reg / 4;
+    return index < PCI_HEADER_DWORDS &&
+        index != STATUS / 4 && index != BIST / 4;
+}
+
 uint32_t pci_dev_read_config_reg(PCI_Device *dev, uint8_t reg) {
+    if (is_cached(reg))
+        return dev->header[reg / 4] >> ((reg & 0x3) * 8);
     return config_read_reg(dev->bus, dev->device, dev->func, reg);
 }
 
+void pci_dev_write_config_reg(PCI_Device *dev, uint8_t reg, uint32_t value) {
+    config_write_reg(dev->bus, dev->device, dev->func, reg, value);
+
+    // Read back what the device kept, read-only bits and BAR sizes included
+    if (reg / 4 < PCI_HEADER_DWORDS)
+        dev->header[reg / 4] =
+            config_read_reg(dev->bus, dev->device, dev->func, reg & 0xFC);
+}
+
+void pci_dev_enable_bus_master(PCI_Device *dev) {
+    // The status register shares this dword, writing zeros leaves it alone
+    uint16_t command = pci_dev_read_config_reg(dev, COMMAND);
+    command |= COMMAND_IO_SPACE | COMMAND_MEMORY_SPACE | COMMAND_BUS_MASTER;
+    pci_dev_write_config_reg(dev, COMMAND, command);
+}
+
+uint8_t pci_dev_find_capability(PCI_Device *dev, uint8_t id) {
+    uint16_t status = pci_dev_read_config_reg(dev, STATUS);
+    if ((status & STATUS_CAPABILITIES) == 0) return 0;
+
+    // The list can not be longer than the configuration space holds, which
+    // guards against a loop in a broken list
+    uint8_t offset = pci_dev_read_config_reg(dev, CAPABILITIES) & 0xFC;
+    for (int i = 0; i < 48 && offset != 0; i++) {
+        uint32_t header = pci_dev_read_config_reg(dev, offset);
+        if ((header & 0xFF) == id) return offset;
+        offset = (header >> 8) & 0xFC;
+    }
+    return 0;
+}
+
+/**
+ * Stop [dev] from raising its legacy interrupt line.
+*/
+static void disable_intx(PCI_Device *dev) {
+    uint16_t command = pci_dev_read_config_reg(dev, COMMAND);
+    pci_dev_write_config_reg(dev, COMMAND, command | COMMAND_INTERRUPT_DISABLE);
+}
+
+static uint32_t msi_address(int cpu) {
+    return MSI_ADDRESS_BASE | ((uint32_t)smp_cpu_apic_id(cpu) << 12);
+}
+
+int pci_dev_enable_msi(PCI_Device *dev, IRQHandler handler, int cpu) {
+    uint8_t cap = dev->msi_cap;
+    if (cap == 0) return -1;
+
+    int vector = irq_allocate_vector(handler);
+    if (vector < 0) return -1;
+
+    // The message control register is the top half of the first dword
+    uint32_t header = pci_dev_read_config_reg(dev, cap);
+    uint16_t control = header >> 16;
+
+    pci_dev_write_config_reg(dev, cap + 4, msi_address(cpu));
+    if (control & MSI_CONTROL_64BIT) {
+        pci_dev_write_config_reg(dev, cap + 8, 0);
+        pci_dev_write_config_reg(dev, cap + 12, vector);
+    } else {
+        pci_dev_write_config_reg(dev, cap + 8, vector);
+    }
+
+    // Only ask for one message, edge triggered with fixed delivery
+    control &= ~MSI_CONTROL_MULTIPLE_ENABLE;
+    control |= MSI_CONTROL_ENABLE;
+    pci_dev_write_config_reg(dev, cap, (header & 0xFFFF) | (control << 16));
+    disable_intx(dev);
+
+    log_info("PCI", "MSI for [bus=%#x, dev=%#x, func=%#x] on vector %#x, CPU %d",
+        dev->bus, dev->device, dev->func, vector, cpu);
+    return vector;
+}
+
+int pci_dev_msix_count(PCI_Device *dev) {
+    if (dev->msix_cap == 0) return 0;
+    uint16_t control = pci_dev_read_config_reg(dev, dev->msix_cap) >> 16;
+    return (control & MSIX_CONTROL_TABLE_SIZE) + 1;
+}
+
+/**
+ * Returns:
+ *   The MSI-X table of [dev] in memory, or NULL if its BAR is not a memory
+ *   BAR that can be reached
+*/
+static volatile MSIX_Entry *msix_table(PCI_Device *dev) {
+    uint32_t table = pci_dev_read_config_reg(dev, dev->msix_cap + 4);
+    uint8_t bir = table & MSIX_TABLE_BIR;
+    if (bir > 5) return NULL;
+
+    uint32_t bar = pci_dev_read_config_reg(dev, BAR0 + bir * 4);
+    if (bar & BAR_IO) return NULL;
+
+    // Memory is identity mapped, so the BAR can be used directly. The upper
+    // half of a 64 bit BAR must be 0 to be reached at all.
+    return (volatile MSIX_Entry *)((bar & ~0xF) + (table & ~MSIX_TABLE_BIR));
+}
+
+int pci_dev_enable_msix(PCI_Device *dev, int entry, IRQHandler handler, int cpu) {
+    uint8_t cap = dev->msix_cap;
+    if (cap == 0 || entry < 0 || entry >= pci_dev_msix_count(dev)) return -1;
+
+    volatile MSIX_Entry *table = msix_table(dev);
+    if (table == NULL) return -1;
+
+    int vector = irq_allocate_vector(handler);
+    if (vector < 0) return -1;
+
+    // Mask the whole function while the entry is changed, and turn MSI-X on
+    // the first time so the table can be written
+    uint32_t header = pci_dev_read_config_reg(dev, cap);
+    uint16_t control = header >> 16;
+    control |= MSIX_CONTROL_ENABLE | MSIX_CONTROL_FUNCTION_MASK;
+    pci_dev_write_config_reg(dev, cap, (header & 0xFFFF) | (control << 16));
+    pci_dev_enable_bus_master(dev);
+    disable_intx(dev);
+
+    table[entry].control = MSIX_ENTRY_MASKED;
+    table[entry].address_low = msi_address(cpu);
+    table[entry].address_high = 0;
+    table[entry].data = vector;
+    table[entry].control = 0;
+
+    control &= ~MSIX_CONTROL_FUNCTION_MASK;
+    pci_dev_write_config_reg(dev, cap, (header & 0xFFFF) | (control << 16));
+
+    log_info("PCI", "MSI-X entry %d for [bus=%#x, dev=%#x, func=%#x] on vector %#x, CPU %d",
+        entry, dev->bus, dev->device, dev->func, vector, cpu);
+    return vector;
+}
+
+bool pci_register_driver(const PCI_Driver *driver) {
+    if (driver_count == PCI_MAX_DRIVERS) {
+        log_warn("PCI", "No room to register driver %s", driver->name);
+        return false;
+    }
+
+    drivers[driver_count++] = driver;
+    return true;
+}
+
+static bool id_matches(const PCI_DeviceId *id, PCI_Device *dev) {
+    if (id->vendor_id != PCI_ANY_ID && id->vendor_id != dev->vendor_id)
+        return false;
+    if (id->device_id != PCI_ANY_ID && id->device_id != dev->device_id)
+        return false;
+    if (id->match_class && (id->class_code != dev->class_code ||
+        id->subclass_code != dev->subclass_code))
+        return false;
+    return true;
+}
+
+/**
+ * Returns:
+ *   The first registered driver with an entry matching [dev], or NULL
+*/
+static const PCI_Driver *find_driver(PCI_Device *dev) {
+    for (int i = 0; i < driver_count; i++) {
+        const PCI_DeviceId *id = drivers[i]->ids;
+        for (; id->vendor_id != 0 || id->match_class; id++)
+            if (id_matches(id, dev)) return drivers[i];
+    }
+    return NULL;
+}
+
+static void probe_device(void *arg) {
+    PCI_Device *dev = arg;
+    const PCI_Driver *driver = dev->driver;
+
+    if (!driver->probe(dev)) {
+        dev->driver = NULL;
+        return;
+    }
+
+    log_info("PCI", "Driver %s bound to [bus=%#x, dev=%#x, func=%#x]",
+        driver->name, dev->bus, dev->device, dev->func);
+}
+
+/**
+ * Give every device found to its driver. Parallel probes are spawned as
+ * tasks so slow ones, like drives timing out, overlap with each other.
+*/
+static void bind_drivers() {
+    TaskGroup group = {0};
+
+    for (ListNode *node = device_list; node != NULL; node = node->next) {
+        PCI_Device *dev = node->value;
+        dev->driver = find_driver(dev);
+        if (dev->driver == NULL) continue;
+
+        if (dev->driver->parallel)
+            task_spawn(&group, probe_device, dev);
+        else
+            probe_device(dev);
+    }
+
+    task_wait(&group);
+}
+
 void pci_initialize(bool v2_installed, uint8_t flags) {
-    printf("Initializing PCI\n");
+    log_info("PCI", "Initializing PCI");
     config_method_1 = v2_installed && (flags & 0x1);
-    if (!config_method_1) {
-        printf("  PCI Configuration Method 1 Not supported.");
-    }
-    scan_bus(0);
 
-    ListNode *curr_dev = device_list;
-    while (curr_dev != NULL) {
-        PCI_Device *dev = curr_dev->value;
-        if ((dev->class_code == 0x01) && (dev->subclass_code == 0x01))
-            ide_initialize(dev);
-        curr_dev = curr_dev->next;
+    // Memory mapped configuration is a plain load or store per register,
+    // the ports are only used for buses outside of it
+    const MCFG_Region *mcfg = acpi_get_mcfg_region();
+    if (mcfg != NULL) {
+        ecam_base = (volatile uint8_t *)mcfg->base;
+        ecam_start_bus = mcfg->start_bus;
+        ecam_end_bus = mcfg->end_bus;
+        log_info("PCI", "Using memory mapped configuration at %#x", mcfg->base);
+    } else if (!config_method_1) {
+        log_warn("PCI", "PCI Configuration Method 1 Not supported.");
     }
-    
+    scan_bus(0);
+    bind_drivers();
 
-    printf("Initialized PCI\n");
+    log_info("PCI", "Initialized PCI");
 }
\ No newline at end of file
@@ -3,13 +3,158 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <arch/i686/irq.h>
+
+// Dwords of the standard configuration header kept in each PCI_Device
+#define PCI_HEADER_DWORDS 16
+
+// Capability ids
+#define PCI_CAP_MSI     0x05
+#define PCI_CAP_MSIX    0x11
+
+// Most drivers that can be registered
+#define PCI_MAX_DRIVERS 16
+
+// Matches any vendor or device id in a PCI_DeviceId
+#define PCI_ANY_ID      0xFFFF
+
+typedef struct PCI_Driver PCI_Driver;
+
 typedef struct {
     uint8_t bus;
     uint8_t device;
     uint8_t func;
     uint8_t class_code;
     uint8_t subclass_code;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t msi_cap;            // Offset of the MSI capability, 0 if none
+    uint8_t msix_cap;           // Offset of the MSI-X capability, 0 if none
+
+    // Copy of the header, kept up to date by pci_dev_write_config_reg
+    uint32_t header[PCI_HEADER_DWORDS];
+
+    const PCI_Driver *driver;   // The driver that took the device, or NULL
 } PCI_Device;
 
+/**
+ * One entry of a driver's match table. Tables end with PCI_DEVICE_END.
+*/
+typedef struct {
+    uint16_t vendor_id;         // PCI_ANY_ID matches any vendor
+    uint16_t device_id;         // PCI_ANY_ID matches any device
+    uint8_t class_code;
+    uint8_t subclass_code;
+    bool match_class;           // Whether the class and subclass must match
+} PCI_DeviceId;
+
+#define PCI_DEVICE(vendor, device) { (vendor), (device), 0, 0, false }
+#define PCI_DEVICE_CLASS(class, subclass) \
+    { PCI_ANY_ID, PCI_ANY_ID, (class), (subclass), true }
+#define PCI_DEVICE_END { 0, 0, 0, 0, false }
+
+struct PCI_Driver {
+    const char *name;
+    const PCI_DeviceId *ids;
+
+    // Set up [dev]. Returns whether the driver took the device.
+    bool (*probe)(PCI_Device *dev);
+
+    // Whether probe can run as a task on any CPU, alongside the probes of
+    // other devices. Probes that are not parallel run on the boot CPU.
+    bool parallel;
+};
+
+/**
+ * Add [driver] to the drivers matched against the devices found by
+ * pci_initialize. Must be called before pci_initialize. Each device is
+ * given to the first registered driver whose table matches it.
+ * 
+ * Returns:
+ *   Whether there was room to register the driver
+*/
+bool pci_register_driver(const PCI_Driver *driver);
+
 void pci_initialize(bool v2_installed, uint8_t flags);
-uint32_t pci_dev_read_config_reg(PCI_Device *dev, uint8_t reg);
\ No newline at end of file
+
+/**
+ * Read the configuration register at [reg] of [dev], shifted down so the
+ * register is in the low bits. Reads from the standard header come from the
+ * copy in [dev], except for the status and BIST registers which the device
+ * changes itself.
+ * 
+ * Parameters:
+ *   dev: The device to read from
+ *   reg: The offset of the register in the configuration space
+ * 
+ * Returns:
+ *   The dword containing the register, shifted right by its byte offset
+*/
+uint32_t pci_dev_read_config_reg(PCI_Device *dev, uint8_t reg);
+
+/**
+ * Write the 32-bit configuration register at [reg] of [dev]. [reg] must be
+ * 4 byte aligned.
+ * 
+ * Parameters:
+ *   dev: The device to write to
+ *   reg: The offset of the register in the configuration space
+ *   value: The value to write
+*/
+void pci_dev_write_config_reg(PCI_Device *dev, uint8_t reg, uint32_t value);
+
+/**
+ * Let [dev] decode I/O and memory accesses and act as a bus master so it can
+ * DMA to and from memory.
+ * 
+ * Parameters:
+ *   dev: The device to enable
+*/
+void pci_dev_enable_bus_master(PCI_Device *dev);
+
+/**
+ * Find capability [id] in the capability list of [dev].
+ * 
+ * Returns:
+ *   The offset of the capability in the configuration space, 0 if the device
+ *   does not have it
+*/
+uint8_t pci_dev_find_capability(PCI_Device *dev, uint8_t id);
+
+/**
+ * Switch [dev] from its legacy interrupt line to a single MSI vector that is
+ * delivered to [cpu].
+ * 
+ * Parameters:
+ *   dev: The device
+ *   handler: The function to call when the device interrupts
+ *   cpu: The index of the CPU to deliver the interrupt to
+ * 
+ * Returns:
+ *   The vector allocated, or -1 if the device has no MSI capability, the
+ *   APIC is not in use or no vector is free
+*/
+int pci_dev_enable_msi(PCI_Device *dev, IRQHandler handler, int cpu);
+
+/**
+ * Returns:
+ *   The number of entries in the MSI-X table of [dev], 0 if it has none
+*/
+int pci_dev_msix_count(PCI_Device *dev);
+
+/**
+ * Give entry [entry] of the MSI-X table of [dev] its own vector delivered to
+ * [cpu]. Multi-queue devices use one entry per queue so each queue's
+ * completions go to the CPU that submits to it. The first call switches the
+ * device from its legacy interrupt line to MSI-X.
+ * 
+ * Parameters:
+ *   dev: The device
+ *   entry: The index of the table entry
+ *   handler: The function to call when the entry is raised
+ *   cpu: The index of the CPU to deliver the interrupt to
+ * 
+ * Returns:
+ *   The vector allocated, or -1 on failure
+*/
+int pci_dev_enable_msix(PCI_Device *dev, int entry, IRQHandler handler, int cpu);
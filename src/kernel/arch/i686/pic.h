@@ -1,5 +1,6 @@
 #pragma once
 
+#include "isr.h"
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -11,4 +12,11 @@ typedef struct {
     void (*send_eoi)(int irq);
     void (*mask)(int irq);
     void (*unmask)(int irq);
+
+    // Whether [irq] was raised without a device asserting it. Takes care of
+    // any acknowledgement still needed. May be NULL.
+    bool (*is_spurious)(int irq);
+
+    // Describe how a fast path stub acknowledges [irq]. May be NULL.
+    void (*fast_eoi)(int irq, ISR_FastEOI *eoi);
 } PIC_Driver;
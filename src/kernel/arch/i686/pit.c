@@ -0,0 +1,92 @@
+#include "pit.h"
+
+#include <arch/i686/io.h>
+#include <arch/i686/spinlock.h>
+
+static enum {
+    PORT_CHANNEL_0  = 0x40,
+    PORT_CHANNEL_2  = 0x42,
+    PORT_COMMAND    = 0x43,
+    PORT_CONTROL    = 0x61
+} PIT_PORTS;
+
+static enum {
+    CONTROL_GATE_2      = 0x01,
+    CONTROL_SPEAKER     = 0x02,
+    CONTROL_OUT_2       = 0x20
+} PIT_CONTROL_BITS;
+
+static enum {
+    CMD_CHANNEL_0       = 0x00,
+    CMD_CHANNEL_2       = 0x80,
+    CMD_LATCH           = 0x00,
+    CMD_ACCESS_LOHI     = 0x30,
+    CMD_MODE_ONESHOT    = 0x00,     // Mode 0, interrupt on terminal count
+    CMD_MODE_RATE       = 0x04,     // Mode 2, rate generator
+} PIT_COMMANDS;
+
+static uint16_t periodic_divisor = 0;
+
+// The command port is shared by every channel and a count is written or read
+// as two bytes, so each sequence must not interleave with one on another CPU
+static Spinlock pit_lock = SPINLOCK_INIT;
+
+uint32_t pit_set_periodic(uint32_t hz) {
+    if (hz == 0) hz = 1;
+
+    uint32_t divisor = (PIT_BASE_FREQUENCY + hz / 2) / hz;
+    if (divisor < 2) divisor = 2;
+    if (divisor > 0xFFFF) divisor = 0xFFFF;
+
+    uint32_t flags = spin_lock_irqsave(&pit_lock);
+    out_byte(PORT_COMMAND, CMD_CHANNEL_0 | CMD_ACCESS_LOHI | CMD_MODE_RATE);
+    out_byte(PORT_CHANNEL_0, divisor & 0xFF);
+    out_byte(PORT_CHANNEL_0, divisor >> 8);
+    periodic_divisor = divisor;
+    spin_unlock_irqrestore(&pit_lock, flags);
+
+    return PIT_BASE_FREQUENCY / divisor;
+}
+
+void pit_set_oneshot(uint16_t count) {
+    uint32_t flags = spin_lock_irqsave(&pit_lock);
+    out_byte(PORT_COMMAND, CMD_CHANNEL_0 | CMD_ACCESS_LOHI | CMD_MODE_ONESHOT);
+    out_byte(PORT_CHANNEL_0, count & 0xFF);
+    out_byte(PORT_CHANNEL_0, count >> 8);
+    spin_unlock_irqrestore(&pit_lock, flags);
+}
+
+uint16_t pit_get_divisor() {
+    return periodic_divisor;
+}
+
+uint16_t pit_read_count() {
+    uint32_t flags = spin_lock_irqsave(&pit_lock);
+    out_byte(PORT_COMMAND, CMD_CHANNEL_0 | CMD_LATCH);
+    uint16_t count = in_byte(PORT_CHANNEL_0);
+    count |= in_byte(PORT_CHANNEL_0) << 8;
+    spin_unlock_irqrestore(&pit_lock, flags);
+    return count;
+}
+
+uint64_t pit_measure_tsc(uint16_t count) {
+    // Hold the gate low and the speaker off while the count is loaded
+    uint32_t flags = spin_lock_irqsave(&pit_lock);
+    uint8_t control = in_byte(PORT_CONTROL);
+    control &= ~(CONTROL_GATE_2 | CONTROL_SPEAKER);
+    out_byte(PORT_CONTROL, control);
+
+    out_byte(PORT_COMMAND, CMD_CHANNEL_2 | CMD_ACCESS_LOHI | CMD_MODE_ONESHOT);
+    out_byte(PORT_CHANNEL_2, count & 0xFF);
+    out_byte(PORT_CHANNEL_2, count >> 8);
+    spin_unlock_irqrestore(&pit_lock, flags);
+
+    // Raising the gate starts the count, OUT goes high when it reaches 0
+    out_byte(PORT_CONTROL, control | CONTROL_GATE_2);
+    uint64_t start = read_tsc();
+    while ((in_byte(PORT_CONTROL) & CONTROL_OUT_2) == 0);
+    uint64_t end = read_tsc();
+
+    out_byte(PORT_CONTROL, control);
+    return end - start;
+}
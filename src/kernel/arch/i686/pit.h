@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+// Frequency of the clock driving the PIT counters in Hz
+#define PIT_BASE_FREQUENCY 1193182
+
+/**
+ * Program channel 0 of the PIT to interrupt on IRQ 0 at [hz] times a second.
+ * 
+ * Parameters:
+ *   hz: The requested interrupt rate
+ * 
+ * Returns:
+ *   The rate actually programmed, the closest the divisor allows
+*/
+uint32_t pit_set_periodic(uint32_t hz);
+
+/**
+ * Program channel 0 of the PIT to interrupt once after [count] input clocks,
+ * using mode 0. The counter keeps counting down past 0 without reloading.
+ * 
+ * Parameters:
+ *   count: The number of PIT clocks to wait, 0 counts as 65536
+*/
+void pit_set_oneshot(uint16_t count);
+
+/**
+ * Returns:
+ *   The divisor programmed by the last call to pit_set_periodic
+*/
+uint16_t pit_get_divisor();
+
+/**
+ * Returns:
+ *   The current count of channel 0. It counts down to 0 once per period and
+ *   is then reloaded.
+*/
+uint16_t pit_read_count();
+
+/**
+ * Count TSC cycles while channel 2 of the PIT counts down [count] input
+ * clocks. Channel 2 is gated by port 0x61 and does not interrupt, so this
+ * leaves the tick on channel 0 alone. Must be called with interrupts
+ * disabled.
+ * 
+ * Parameters:
+ *   count: The number of PIT clocks to time
+ * 
+ * Returns:
+ *   The TSC cycles that passed
+*/
+uint64_t pit_measure_tsc(uint16_t count);
@@ -6,6 +6,12 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <tasklet.h>
+#include <timer.h>
+
+// Bytes each port can buffer between the interrupt and its tasklet. Must be
+// a power of 2.
+#define RX_RING_SIZE 16
 
 static enum {
     PORT_DATA   = 0x60,
@@ -81,26 +87,53 @@ static bool channel_2_ok = false;
 static PS2_Device port1_device;
 static PS2_Device port2_device;
 
-static const int WAIT_TIME = 0xFFFF;
+/**
+ * Bytes read by a port's interrupt handler, waiting for its tasklet. The
+ * handler only writes head and the tasklet only writes tail.
+*/
+typedef struct {
+    uint8_t bytes[RX_RING_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t dropped;
+    PS2_Device *device;
+    Tasklet tasklet;
+} RxRing;
+
+static void deliver_bytes(void *arg);
+
+static RxRing port1_rx = {
+    .device = &port1_device,
+    .tasklet = TASKLET_INIT(deliver_bytes, &port1_rx)
+};
+static RxRing port2_rx = {
+    .device = &port2_device,
+    .tasklet = TASKLET_INIT(deliver_bytes, &port2_rx)
+};
+
+// How long to wait for the controller before giving up
+static const int WAIT_TIME_MS = 50;
 
 static int wait_ps2_cmd() {
-    int wait_timer = WAIT_TIME;
+    Timeout timeout;
+    timeout_start(&timeout, WAIT_TIME_MS);
     io_wait();
-    while(((in_byte(PORT_STATUS) & 0x2) != 0) && (--wait_timer != 0));
+    while(((in_byte(PORT_STATUS) & 0x2) != 0) && !timeout_expired(&timeout));
     if ((in_byte(PORT_STATUS) & 0x2) != 0) return ERROR_TIMEOUT;
     return 0;
 }
 
 static bool wait_ps2_data() {
-    int wait_timer = WAIT_TIME;
+    Timeout timeout;
+    timeout_start(&timeout, WAIT_TIME_MS);
     io_wait();
-    while((in_byte(PORT_STATUS) & 0x1) == 0 && (--wait_timer != 0));
+    while((in_byte(PORT_STATUS) & 0x1) == 0 && !timeout_expired(&timeout));
     if ((in_byte(PORT_STATUS) & 0x1) == 0) return ERROR_TIMEOUT;
     return 0;
 }
 
 static bool detect_ps2() {
-    printf("Detecting Presence of PS/2 Controller...\n");
+    log_info("PS/2", "Detecting Presence of PS/2 Controller...");
     FADT* fadt = get_fadt();
     int acpi_version = fadt->header.revision;
 
@@ -109,13 +142,13 @@ static bool detect_ps2() {
         is_present = true;
     else if (acpi_version > 1) {
         is_present = (fadt->boot_architecture_flags & 0x2) != 0;
-        printf("Boot Architecture Flags: %#x", fadt->boot_architecture_flags);
+        log_info("PS/2", "Boot Architecture Flags: %#x", fadt->boot_architecture_flags);
     }
 
     if (is_present)
-        printf("  PS/2 Controller [Present]\n");
+        log_info("PS/2", "PS/2 Controller [Present]");
     else
-        printf("  PS/2 Controller [Missing]\n");
+        log_warn("PS/2", "PS/2 Controller [Missing]");
 
     return is_present;
 }
@@ -282,8 +315,8 @@ static int initialize_device(PS2_Device *device) {
 
     device->type = determine_device_type(byte_1, byte_2);
 
-    printf("    Device Identification: %#x, %#x\n", byte_1, byte_2);
-    printf("    Device Type: %s\n", ps_2_device_type_names[device->type]);
+    log_info("PS/2", "Device Identification: %#x, %#x", byte_1, byte_2);
+    log_info("PS/2", "Device Type: %s", ps_2_device_type_names[device->type]);
 
     return 0;
 }
@@ -305,13 +338,13 @@ static void initialize_devices() {
         .on_byte_recieved = NULL
     };
 
-    printf("  Detecting Devices...\n");
+    log_info("PS/2", "Detecting Devices...");
     if(detect_device(&port1_device) >= 0) 
-        printf("    Device detected on port 1\n");
+        log_info("PS/2", "Device detected on port 1");
     if(detect_device(&port2_device) >= 0) 
-        printf("    Device detected on port 2\n");
+        log_info("PS/2", "Device detected on port 2");
 
-    printf("  Initializing Devices...\n");
+    log_info("PS/2", "Initializing Devices...");
     set_scanning(&port1_device, false);
     set_scanning(&port2_device, false);
 
@@ -322,16 +355,44 @@ static void initialize_devices() {
     set_scanning(&port2_device, true);
 }
 
-static void port_1_interrupt(Registers* regs) {
+/**
+ * Pass the bytes a port has received on to its device driver. Runs as a
+ * tasklet with interrupts enabled.
+*/
+static void deliver_bytes(void *arg) {
+    RxRing *ring = arg;
+
+    while (ring->tail != ring->head) {
+        uint8_t byte = ring->bytes[ring->tail & (RX_RING_SIZE - 1)];
+        ring->tail++;
+
+        if (ring->device->on_byte_recieved != NULL)
+            ring->device->on_byte_recieved(byte);
+    }
+}
+
+/**
+ * Read the byte waiting in the controller and queue it for the tasklet.
+*/
+static void receive_byte(RxRing *ring) {
     uint8_t byte = in_byte(PORT_DATA);
-    if (port1_device.on_byte_recieved != NULL)
-        port1_device.on_byte_recieved(byte);
+
+    if (ring->head - ring->tail == RX_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+
+    ring->bytes[ring->head & (RX_RING_SIZE - 1)] = byte;
+    ring->head++;
+    tasklet_schedule(&ring->tasklet);
+}
+
+static void port_1_interrupt(Registers* regs) {
+    receive_byte(&port1_rx);
 }
 
 static void port_2_interrupt(Registers* regs) {
-    uint8_t byte = in_byte(PORT_DATA);
-    if (port2_device.on_byte_recieved != NULL)
-        port2_device.on_byte_recieved(byte);
+    receive_byte(&port2_rx);
 }
 
 PS2_Device* ps2_get_port_1_device() {
@@ -352,29 +413,29 @@ void ps2_initialize() {
 
     if (!detect_ps2()) return;
 
-    printf("Intializing PS/2 Controller...\n");
+    log_info("PS/2", "Intializing PS/2 Controller...");
 
     // Disable ports
     disable_port(PORT_1);
     disable_port(PORT_2);
-    printf("  Disabled PS/2 Ports\n");
+    log_info("PS/2", "Disabled PS/2 Ports");
 
     // Flush the ouput buffer
     in_byte(PORT_DATA);
-    printf("  Flushed PS/2 Output Buffer\n");
+    log_info("PS/2", "Flushed PS/2 Output Buffer");
 
     // Change the configuration byte
     uint8_t configuration = configure();
     is_dual_channel = (configuration & (1 << 5)) != 0;
-    printf("  Configured PS/2\n");
+    log_info("PS/2", "Configured PS/2");
 
     // Perform the self test
-    printf("  Performing PS/2 Self Test...\n");
+    log_info("PS/2", "Performing PS/2 Self Test...");
     if (perform_self_test()) {
-        printf("    Self Test [OK]\n");
+        log_info("PS/2", "Self Test [OK]");
     } else {
-        printf("    Self Test [ERROR]\n");
-        printf("  PS/2 Initialization [FAILED]\n");
+        log_error("PS/2", "Self Test [ERROR]");
+        log_error("PS/2", "PS/2 Initialization [FAILED]");
         return;
     }
 
@@ -382,7 +443,7 @@ void ps2_initialize() {
     write_configuration(configuration);
 
     // Check that is actually is a dual channel
-    printf("  Detecting Channels...\n");
+    log_info("PS/2", "Detecting Channels...");
     if (is_dual_channel) {
         enable_port(PORT_2);
 
@@ -393,19 +454,19 @@ void ps2_initialize() {
     }
 
     if (is_dual_channel)
-        printf("    Dected Dual Channel\n");
+        log_info("PS/2", "Dected Dual Channel");
     else
-        printf("    Detected Single Channel\n");
+        log_info("PS/2", "Detected Single Channel");
 
     // Test Channels
-    printf("  Testing Channels...\n");
+    log_info("PS/2", "Testing Channels...");
     channel_1_ok = test_port(PORT_1);
     channel_2_ok = test_port(PORT_2);
-    printf("    Channel 1 [%s]\n", channel_1_ok ? "OK" : "ERROR");
-    printf("    Channel 2 [%s]\n", channel_2_ok ? "OK" : "ERROR");
+    log_info("PS/2", "Channel 1 [%s]", channel_1_ok ? "OK" : "ERROR");
+    log_info("PS/2", "Channel 2 [%s]", channel_2_ok ? "OK" : "ERROR");
 
     enable_availiable_channels();
-    printf("  Enabled Availiable Channels\n");
+    log_info("PS/2", "Enabled Availiable Channels");
 
     initialize_devices();
 
@@ -415,5 +476,5 @@ void ps2_initialize() {
     enable_irqs();
 
     is_initialized = true;
-    printf("Initialized PS/2\n");
+    log_info("PS/2", "Initialized PS/2");
 }
\ No newline at end of file
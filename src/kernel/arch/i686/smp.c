@@ -0,0 +1,188 @@
+#include "smp.h"
+
+#include <arch/i686/acpi.h>
+#include <arch/i686/apic.h>
+#include <arch/i686/fpu.h>
+#include <arch/i686/gdt.h>
+#include <arch/i686/idt.h>
+#include <arch/i686/io.h>
+#include <arch/i686/isr.h>
+#include <debug.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <string.h>
+#include <timer.h>
+
+// How long to wait between the INIT and startup IPIs, and for a processor
+// to come up after them
+#define INIT_DELAY_MS       10
+#define STARTUP_DELAY_MS    1
+#define ONLINE_TIMEOUT_MS   100
+
+typedef struct {
+    uint32_t stack;
+    uint32_t entry;
+} __attribute__((packed)) TrampolineParams;
+
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint8_t smp_trampoline_params[];
+
+static CPU cpus[MAX_CPUS];
+static volatile int cpu_count = 1;
+
+// Index of the processor being started, read by ap_entry
+static volatile int starting_cpu = 0;
+
+// Bit n is set while CPU n is halted waiting for work
+static volatile uint32_t idle_cpus = 0;
+
+static void delay(uint32_t ms) {
+    Timeout timeout;
+    timeout_start(&timeout, ms);
+    while (!timeout_expired(&timeout)) cpu_relax();
+}
+
+static bool wake_interrupt(int interrupt) {
+    // Only here to end the halt, the stub sends the EOI
+    return false;
+}
+
+/**
+ * Run tasks, and halt when there are none until woken by an IPI.
+*/
+static void ap_idle_loop(CPU *cpu) {
+    uint32_t bit = 1u << cpu->index;
+
+    for (;;) {
+        if (task_run_one()) continue;
+
+        // Advertise being idle before checking for work one last time, so a
+        // task queued in between always sends a wake-up IPI
+        disable_interrupts();
+        __atomic_or_fetch(&idle_cpus, bit, __ATOMIC_SEQ_CST);
+        if (!task_pending()) enable_interrupts_and_halt();
+        __atomic_and_fetch(&idle_cpus, ~bit, __ATOMIC_SEQ_CST);
+        enable_interrupts();
+    }
+}
+
+/**
+ * Called by the trampoline on the application processor's own stack, with
+ * interrupts disabled.
+*/
+static void ap_entry() {
+    CPU *cpu = &cpus[starting_cpu];
+
+    gdt_load_cpu(cpu->index);
+    idt_initialize();
+    apic_initialize_cpu();
+    fpu_initialize_cpu();
+
+    __atomic_store_n(&cpu->online, true, __ATOMIC_RELEASE);
+    ap_idle_loop(cpu);
+}
+
+/**
+ * Start the processor for [cpu] and wait for it to come online.
+ * 
+ * Returns:
+ *   Whether it came online
+*/
+static bool start_cpu(CPU *cpu) {
+    cpu->stack = aligned_alloc(16, SMP_STACK_SIZE);
+    if (cpu->stack == NULL) return false;
+
+    TrampolineParams *params = (TrampolineParams *)(SMP_TRAMPOLINE_ADDRESS +
+        (smp_trampoline_params - smp_trampoline_start));
+    params->stack = (uint32_t)cpu->stack + SMP_STACK_SIZE;
+    params->entry = (uint32_t)ap_entry;
+    starting_cpu = cpu->index;
+
+    apic_send_init(cpu->apic_id);
+    delay(INIT_DELAY_MS);
+
+    // The second startup IPI is only needed by processors that miss the
+    // first one
+    for (int i = 0; i < 2 && !cpu->online; i++) {
+        apic_send_startup(cpu->apic_id, SMP_TRAMPOLINE_ADDRESS);
+        delay(STARTUP_DELAY_MS);
+    }
+
+    Timeout timeout;
+    timeout_start(&timeout, ONLINE_TIMEOUT_MS);
+    while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE)) {
+        if (timeout_expired(&timeout)) return false;
+        cpu_relax();
+    }
+    return true;
+}
+
+void smp_initialize() {
+    for (int i = 0; i < MAX_CPUS; i++) {
+        cpus[i].index = i;
+        gdt_set_cpu_segment(i, &cpus[i], sizeof(CPU));
+    }
+
+    cpus[0].online = true;
+    gdt_load_cpu(0);
+}
+
+void smp_start_aps() {
+    const MADT_Info *madt = acpi_get_madt_info();
+    if (apic_enabled()) cpus[0].apic_id = apic_local_id();
+
+    if (!apic_enabled() || madt == NULL || madt->cpu_count <= 1) {
+        log_info("SMP", "Running on the boot processor only");
+        return;
+    }
+
+    _Static_assert(SMP_TRAMPOLINE_ADDRESS + 0x1000 <= LOW_MEMORY_RESERVED,
+        "The trampoline must be in reserved low memory");
+    memcpy((void *)SMP_TRAMPOLINE_ADDRESS, smp_trampoline_start,
+        smp_trampoline_end - smp_trampoline_start);
+
+    ISR_FastEOI eoi = { apic_eoi_register(), 0, 0 };
+    isr_register_fast_handler(SMP_WAKE_VECTOR, wake_interrupt, &eoi);
+
+    uint8_t boot_apic_id = cpus[0].apic_id;
+
+    for (int i = 0; i < madt->cpu_count; i++) {
+        uint8_t apic_id = madt->cpu_apic_ids[i];
+        if (apic_id == boot_apic_id) continue;
+
+        if (cpu_count == MAX_CPUS) {
+            log_warn("SMP", "Only using %d CPUs", MAX_CPUS);
+            break;
+        }
+
+        CPU *cpu = &cpus[cpu_count];
+        cpu->apic_id = apic_id;
+        if (!start_cpu(cpu)) {
+            // Park it again so it can not start late on a reused slot
+            apic_send_init(apic_id);
+            log_warn("SMP", "CPU with APIC id %d did not start", apic_id);
+            continue;
+        }
+
+        task_cpu_online(cpu->index);
+        cpu_count++;
+    }
+
+    log_info("SMP", "%d CPUs online", cpu_count);
+}
+
+int smp_cpu_count() {
+    return cpu_count;
+}
+
+uint8_t smp_cpu_apic_id(int cpu) {
+    if (cpu < 0 || cpu >= cpu_count) cpu = 0;
+    return cpus[cpu].apic_id;
+}
+
+void smp_wake_idle_cpus() {
+    uint32_t idle = __atomic_load_n(&idle_cpus, __ATOMIC_SEQ_CST);
+    for (int i = 0; idle != 0; i++, idle >>= 1)
+        if (idle & 1) apic_send_ipi(cpus[i].apic_id, SMP_WAKE_VECTOR);
+}
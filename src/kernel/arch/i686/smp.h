@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <defs.h>
+#include <task.h>
+
+// Physical address application processors start at. Must be page aligned,
+// below 1MiB and inside LOW_MEMORY_RESERVED.
+#define SMP_TRAMPOLINE_ADDRESS 0x8000
+
+// Size of each application processor's stack
+#define SMP_STACK_SIZE 16384
+
+// Vector used to wake idle application processors when work is queued
+#define SMP_WAKE_VECTOR 0xF0
+
+/**
+ * Data private to one CPU, reached through the gs segment.
+*/
+typedef struct {
+    int index;                  // Must be first, read by smp_cpu_id
+    uint8_t apic_id;
+    volatile bool online;
+    void *stack;
+} CPU;
+
+/**
+ * Set up the per-CPU data of the boot processor. Must be called right after
+ * gdt_initialize, before smp_cpu_id is used.
+*/
+void smp_initialize();
+
+/**
+ * Start the application processors listed in the MADT with INIT-SIPI-SIPI.
+ * Each one loads the GDT and IDT, enables its local APIC and then waits for
+ * tasks to run. Does nothing unless the APIC driver is in use.
+*/
+void smp_start_aps();
+
+/**
+ * Returns:
+ *   The index of the calling CPU, 0 for the boot processor
+*/
+int ASMCALL smp_cpu_id();
+
+/**
+ * Returns:
+ *   The number of CPUs running
+*/
+int smp_cpu_count();
+
+/**
+ * Returns:
+ *   The local APIC id of CPU [cpu], used to target interrupts at it
+*/
+uint8_t smp_cpu_apic_id(int cpu);
+
+/**
+ * Send a wake-up IPI to application processors halted waiting for work.
+*/
+void smp_wake_idle_cpus();
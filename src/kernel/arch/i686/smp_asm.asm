@@ -0,0 +1,73 @@
+[bits 32]
+
+SMP_TRAMPOLINE_ADDRESS equ 0x8000
+
+; Address of a trampoline label once it has been copied into low memory
+%define TRAMPOLINE(label) (SMP_TRAMPOLINE_ADDRESS + (label - smp_trampoline_start))
+
+;
+; int smp_cpu_id();
+;
+global smp_cpu_id
+smp_cpu_id:
+    mov eax, [gs:0]     ; CPU.index
+    ret
+
+;
+; Application processors start here in real mode after the startup IPI. The
+; code is copied to SMP_TRAMPOLINE_ADDRESS so it only uses addresses relative
+; to it. It switches to protected mode with a flat GDT and calls the entry
+; point in smp_trampoline_params on the stack given there.
+;
+[bits 16]
+global smp_trampoline_start
+smp_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    lgdt [TRAMPOLINE(trampoline_gdt_descriptor)]
+
+    mov eax, cr0
+    or eax, 1           ; Protection enable
+    mov cr0, eax
+
+    jmp dword 0x08:TRAMPOLINE(.protected_mode)
+
+[bits 32]
+.protected_mode:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    mov esp, [TRAMPOLINE(smp_trampoline_params.stack)]
+    call [TRAMPOLINE(smp_trampoline_params.entry)]
+
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+align 8
+trampoline_gdt:
+    dq 0                        ; Null descriptor
+    dq 0x00CF9A000000FFFF       ; Flat 32-bit code
+    dq 0x00CF92000000FFFF       ; Flat 32-bit data
+
+trampoline_gdt_descriptor:
+    dw trampoline_gdt_descriptor - trampoline_gdt - 1
+    dd TRAMPOLINE(trampoline_gdt)
+
+; Filled in by smp_start_aps for each processor
+align 4
+global smp_trampoline_params
+smp_trampoline_params:
+.stack: dd 0
+.entry: dd 0
+
+global smp_trampoline_end
+smp_trampoline_end:
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <arch/i686/io.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * A test-and-test-and-set lock for data shared between CPUs. Waiters spin
+ * on a plain read so the cache line is only written when the lock is free.
+*/
+typedef struct {
+    volatile uint32_t locked;
+} Spinlock;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_lock(Spinlock *lock) {
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED))
+            cpu_relax();
+    }
+}
+
+static inline bool spin_trylock(Spinlock *lock) {
+    return !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void spin_unlock(Spinlock *lock) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Disable interrupts and take [lock], so an interrupt handler on this CPU
+ * can not deadlock trying to take it too.
+ *
+ * Returns:
+ *   The interrupt flags to pass to spin_unlock_irqrestore
+*/
+static inline uint32_t spin_lock_irqsave(Spinlock *lock) {
+    uint32_t flags = save_and_disable_interrupts();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(Spinlock *lock, uint32_t flags) {
+    spin_unlock(lock);
+    restore_interrupts(flags);
+}
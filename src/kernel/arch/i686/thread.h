@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+#include <defs.h>
+
+/**
+ * Save the current thread's callee-saved registers and stack pointer into
+ * [old_esp] and resume the thread whose stack pointer is [new_esp].
+*/
+void ASMCALL context_switch(uint32_t *old_esp, uint32_t new_esp);
@@ -0,0 +1,27 @@
+[bits 32]
+
+;
+; void context_switch(uint32_t *old_esp, uint32_t new_esp);
+;
+; Save the callee-saved registers on the current stack, store the stack
+; pointer in *old_esp, then switch to new_esp and restore the registers that
+; were saved there. Returns on the new thread's stack.
+;
+global context_switch
+context_switch:
+    mov eax, [esp + 4]      ; old_esp in arg[0]
+    mov edx, [esp + 8]      ; new_esp in arg[1]
+
+    push ebp
+    push ebx
+    push esi
+    push edi
+
+    mov [eax], esp
+    mov esp, edx
+
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
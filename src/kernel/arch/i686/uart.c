@@ -0,0 +1,207 @@
+#include "uart.h"
+
+#include <arch/i686/io.h>
+#include <arch/i686/irq.h>
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Size of the transmit ring buffer. Must be a power of 2.
+#define TX_RING_SIZE 4096
+
+#define BAUD_DIVISOR 1          // 115200 baud
+
+static enum {
+    PORT_COM1       = 0x3F8,
+    IRQ_COM1        = 4
+} UART_PORTS;
+
+static enum {
+    REG_DATA            = 0,    // THR / RBR (DLL when DLAB is set)
+    REG_INT_ENABLE      = 1,    // IER (DLM when DLAB is set)
+    REG_INT_ID          = 2,    // IIR when read
+    REG_FIFO_CONTROL    = 2,    // FCR when written
+    REG_LINE_CONTROL    = 3,
+    REG_MODEM_CONTROL   = 4,
+    REG_LINE_STATUS     = 5,
+    REG_MODEM_STATUS    = 6,
+    REG_SCRATCH         = 7
+} UART_REGISTERS;
+
+static enum {
+    IER_RX_AVAILIABLE   = 0x01,
+    IER_TX_EMPTY        = 0x02,
+
+    IIR_NO_INTERRUPT    = 0x01,
+    IIR_ID_MASK         = 0x0E,
+    IIR_TX_EMPTY        = 0x02,
+    IIR_FIFO_MASK       = 0xC0,
+    IIR_FIFO_ENABLED    = 0xC0,
+
+    FCR_ENABLE          = 0x01,
+    FCR_CLEAR_RX        = 0x02,
+    FCR_CLEAR_TX        = 0x04,
+    FCR_TRIGGER_14      = 0xC0,
+
+    LCR_8N1             = 0x03,
+    LCR_DLAB            = 0x80,
+
+    MCR_DTR             = 0x01,
+    MCR_RTS             = 0x02,
+    MCR_OUT2            = 0x08,     // Gates the IRQ line on PC serial ports
+    MCR_LOOPBACK        = 0x10,
+
+    LSR_TX_EMPTY        = 0x20
+} UART_BITS;
+
+static bool present = false;
+static int fifo_size = 1;
+
+static char tx_ring[TX_RING_SIZE];
+static volatile uint32_t tx_head = 0;   // Next byte to be queued
+static volatile uint32_t tx_tail = 0;   // Next byte to be sent
+static volatile bool tx_active = false; // Waiting for a THRE interrupt
+
+static void write_reg(int reg, uint8_t value) {
+    out_byte(PORT_COM1 + reg, value);
+}
+
+static uint8_t read_reg(int reg) {
+    return in_byte(PORT_COM1 + reg);
+}
+
+/**
+ * Move up to a FIFO's worth of bytes from the ring to the transmitter. Must
+ * only be called when the transmitter holding register is empty and with
+ * interrupts disabled.
+ *
+ * Returns:
+ *   The number of bytes moved
+*/
+static int fill_fifo() {
+    int count = 0;
+    while (count < fifo_size && tx_tail != tx_head) {
+        write_reg(REG_DATA, tx_ring[tx_tail & (TX_RING_SIZE - 1)]);
+        tx_tail++;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Start transmitting the ring if no THRE interrupt is pending. The FIFO is
+ * filled right away if the transmitter is empty, otherwise the interrupt
+ * fills it once the bytes in flight are sent. Must be called with interrupts
+ * disabled.
+*/
+static void start_tx() {
+    if (tx_active || tx_tail == tx_head) return;
+
+    if (read_reg(REG_LINE_STATUS) & LSR_TX_EMPTY) fill_fifo();
+    tx_active = true;
+    write_reg(REG_INT_ENABLE, IER_TX_EMPTY);
+}
+
+/**
+ * Send everything in the ring by polling the line status. Used when the ring
+ * is full or interrupts are not availiable.
+*/
+static void drain_polling() {
+    uint32_t flags = save_and_disable_interrupts();
+
+    while (tx_tail != tx_head) {
+        while ((read_reg(REG_LINE_STATUS) & LSR_TX_EMPTY) == 0);
+        fill_fifo();
+    }
+
+    restore_interrupts(flags);
+}
+
+static void uart_interrupt(Registers *regs) {
+    uint8_t id;
+    while (((id = read_reg(REG_INT_ID)) & IIR_NO_INTERRUPT) == 0) {
+        switch (id & IIR_ID_MASK) {
+        case IIR_TX_EMPTY:
+            if (fill_fifo() == 0) {
+                tx_active = false;
+                write_reg(REG_INT_ENABLE, 0);
+            }
+            break;
+        default:
+            // Clear the other sources by reading their status registers
+            read_reg(REG_LINE_STATUS);
+            read_reg(REG_MODEM_STATUS);
+            read_reg(REG_DATA);
+            break;
+        }
+    }
+}
+
+bool uart_present() {
+    return present;
+}
+
+size_t uart_write(const char *data, size_t size) {
+    if (!present) return 0;
+
+    // Interrupts are held off so writers in interrupt handlers can not
+    // interleave with this one
+    uint32_t flags = save_and_disable_interrupts();
+
+    for (size_t i = 0; i < size; i++) {
+        if (tx_head - tx_tail == TX_RING_SIZE) drain_polling();
+        tx_ring[tx_head & (TX_RING_SIZE - 1)] = data[i];
+        tx_head++;
+    }
+
+    start_tx();
+    restore_interrupts(flags);
+
+    return size;
+}
+
+void uart_putc(char c) {
+    uart_write(&c, 1);
+}
+
+void uart_flush() {
+    if (!present) return;
+    drain_polling();
+}
+
+void uart_initialize() {
+    present = false;
+
+    write_reg(REG_INT_ENABLE, 0);
+
+    write_reg(REG_LINE_CONTROL, LCR_DLAB);
+    write_reg(REG_DATA, BAUD_DIVISOR & 0xFF);
+    write_reg(REG_INT_ENABLE, BAUD_DIVISOR >> 8);
+    write_reg(REG_LINE_CONTROL, LCR_8N1);
+
+    write_reg(REG_FIFO_CONTROL,
+        FCR_ENABLE | FCR_CLEAR_RX | FCR_CLEAR_TX | FCR_TRIGGER_14);
+
+    // Check that a UART is really there using loopback
+    write_reg(REG_MODEM_CONTROL, MCR_LOOPBACK | MCR_RTS | MCR_DTR);
+    write_reg(REG_DATA, 0xAE);
+    if (read_reg(REG_DATA) != 0xAE) {
+        log_info("Serial", "Serial Port COM1 [Missing]");
+        return;
+    }
+
+    // A 16550A reports its FIFOs as enabled. Older UARTs hold 1 byte.
+    fifo_size =
+        (read_reg(REG_INT_ID) & IIR_FIFO_MASK) == IIR_FIFO_ENABLED ? 16 : 1;
+
+    write_reg(REG_MODEM_CONTROL, MCR_OUT2 | MCR_RTS | MCR_DTR);
+
+    tx_head = 0;
+    tx_tail = 0;
+    tx_active = false;
+    present = true;
+
+    irq_register_handler(IRQ_COM1, uart_interrupt);
+
+    log_info("Serial", "Serial Port COM1 [Present] FIFO: %d bytes", fifo_size);
+}
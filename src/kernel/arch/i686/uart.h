@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Initialize the 16550 UART on COM1 with its FIFOs enabled. Output is queued
+ * in a ring buffer and sent from the transmitter empty interrupt.
+*/
+void uart_initialize();
+
+/**
+ * Returns:
+ *   Whether a UART was found on COM1
+*/
+bool uart_present();
+
+/**
+ * Queue [size] bytes from [data] for transmission. Only blocks when the ring
+ * buffer is full.
+ *
+ * Parameters:
+ *   data: The bytes to send
+ *   size: The number of bytes to send
+ *
+ * Returns:
+ *   The number of bytes queued
+*/
+size_t uart_write(const char *data, size_t size);
+
+void uart_putc(char c);
+
+/**
+ * Send everything that is queued by polling. Used when interrupts are
+ * disabled, such as during a panic.
+*/
+void uart_flush();
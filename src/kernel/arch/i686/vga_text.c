@@ -1,27 +1,112 @@
 #include "vga_text.h"
 
 #include "io.h"
+#include "spinlock.h"
 #include <stdbool.h>
 
 const unsigned SCREEN_WIDTH = 80;
 const unsigned SCREEN_HEIGHT = 25;
 const uint8_t DEFAULT_COLOR = 0x7;
 
-static uint8_t* screen_buffer = (uint8_t*)0xB8000;
+// The text mode window at 0xB8000 is 32KiB. With hardware scrolling the
+// visible screen is a window into this many rows.
+#define VIRTUAL_HEIGHT (0x4000 / 80)
+
+// Two blank cells with the default color, used to clear 32 bits at a time
+#define BLANK_CELLS (((uint32_t)DEFAULT_COLOR << 24) | (DEFAULT_COLOR << 8))
+
+// Dirty row mask with every row of the screen set
+#define ALL_ROWS ((1u << SCREEN_HEIGHT) - 1)
+
+static uint16_t* screen_buffer = (uint16_t*)0xB8000;
 static int cursor_x = 0, cursor_y = 0;
 
+static bool hardware_scroll = true;
+static int origin_row = 0;          // First row of the buffer that is visible
+
+// The shadow buffer is a ring of rows. Screen row 0 is at shadow_top.
+static uint16_t shadow[25 * 80];
+static bool shadowed = true;
+static int shadow_top = 0;
+static volatile uint32_t dirty_rows = 0;    // Rows that differ from VGA memory
+static volatile int pending_scroll = 0;     // Lines VGA memory is behind by
+static volatile bool cursor_moved = false;
+static volatile bool rendering = false;     // A write is changing the shadow
+
+// Serializes writers on different CPUs
+static Spinlock vga_lock = SPINLOCK_INIT;
+
+/**
+ * Get the address of the first cell of screen row [y] in VGA memory
+*/
+static uint16_t *vga_row(int y)
+{
+    return screen_buffer + (origin_row + y) * SCREEN_WIDTH;
+}
+
 /**
- * Set the character at x, y to c and reset to the default color
+ * Get the address of the first cell of screen row [y] in the buffer the
+ * console renders to
+*/
+static uint16_t *row_address(int y)
+{
+    if (!shadowed) return vga_row(y);
+    return shadow + ((shadow_top + y) % SCREEN_HEIGHT) * SCREEN_WIDTH;
+}
+
+/**
+ * Set the character at x, y to c and reset to the default color. The
+ * character and attribute are written as a single 16-bit cell.
 */
 static void set_char(int x, int y, char c) 
 {
-    screen_buffer[2 * (y * SCREEN_WIDTH + x)] = c;
-    screen_buffer[2 * (y * SCREEN_WIDTH + x) + 1] = DEFAULT_COLOR;
+    row_address(y)[x] = (uint8_t)c | ((uint16_t)DEFAULT_COLOR << 8);
+    dirty_rows |= 1u << y;
 }
 
 static char get_char(int x, int y) 
 {
-    return screen_buffer[2 * (y * SCREEN_WIDTH + x)];
+    return row_address(y)[x] & 0xFF;
+}
+
+/**
+ * Copy [count] rows starting at [src] to [dst] 32 bits at a time. Rows are 
+ * copied from the first to the last so [dst] must not be after [src].
+*/
+static void copy_rows(uint16_t *dst, const uint16_t *src, int count)
+{
+    uint32_t *dst_words = (uint32_t *)dst;
+    const uint32_t *src_words = (const uint32_t *)src;
+    int words = count * SCREEN_WIDTH / 2;
+
+    for (int i=0; i<words; i++)
+        dst_words[i] = src_words[i];
+}
+
+/**
+ * Clear [count] rows starting at [row] 32 bits at a time.
+*/
+static void clear_rows(uint16_t *row, int count)
+{
+    uint32_t *words = (uint32_t *)row;
+    int word_count = count * SCREEN_WIDTH / 2;
+
+    for (int i=0; i<word_count; i++)
+        words[i] = BLANK_CELLS;
+}
+
+/**
+ * Set the CRTC start address so the screen shows the buffer from 
+ * [origin_row]. 
+*/
+static void update_start_address()
+{
+    int pos = origin_row * SCREEN_WIDTH;
+
+    out_byte(0x3D4, 0x0C);
+    out_byte(0x3D5, (uint8_t)((pos >> 8) & 0xFF));
+    out_byte(0x3D4, 0x0D);
+    out_byte(0x3D5, (uint8_t) (pos & 0xFF));
 }
 
 /**
@@ -29,7 +114,7 @@ static char get_char(int x, int y)
 */
 static void update_cursor() 
 {
-    int pos = cursor_y * SCREEN_WIDTH + cursor_x;
+    int pos = (origin_row + cursor_y) * SCREEN_WIDTH + cursor_x;
 
     out_byte(0x3D4, 0x0F);
     out_byte(0x3D5, (uint8_t) (pos & 0xFF));
@@ -37,6 +122,94 @@ static void update_cursor()
     out_byte(0x3D5, (uint8_t)((pos >> 8) & 0xFF));
 }
 
+/**
+ * Update the VGA cursor now, or at the next flush if the console is shadowed
+*/
+static void move_cursor()
+{
+    if (shadowed)
+        cursor_moved = true;
+    else
+        update_cursor();
+}
+
+/**
+ * Move the contents of VGA memory up [lines] lines. With hardware scrolling
+ * this usually only moves the CRTC start address; the rows are only copied
+ * when the end of the buffer is reached. The bottom [lines] rows are left
+ * for the caller to fill.
+*/
+static void vga_scroll_rows(int lines)
+{
+    int kept = SCREEN_HEIGHT - lines;
+
+    if (hardware_scroll && origin_row + SCREEN_HEIGHT + lines <= VIRTUAL_HEIGHT) {
+        origin_row += lines;
+        update_start_address();
+    } else if (hardware_scroll) {
+        // Wrap back to the start of the buffer
+        copy_rows(screen_buffer, vga_row(lines), kept);
+        origin_row = 0;
+        update_start_address();
+    } else {
+        copy_rows(vga_row(0), vga_row(lines), kept);
+    }
+}
+
+/**
+ * Move the screen contents up [lines] lines and clear the bottom [lines] 
+ * lines. When shadowed only the shadow ring is rotated and VGA memory is
+ * scrolled at the next flush. The hardware cursor is not updated.
+*/
+static void scroll(int lines)
+{
+    if (lines <= 0) return;
+    if (lines > SCREEN_HEIGHT) lines = SCREEN_HEIGHT;
+
+    int kept = SCREEN_HEIGHT - lines;
+
+    if (shadowed) {
+        shadow_top = (shadow_top + lines) % SCREEN_HEIGHT;
+        dirty_rows = ((dirty_rows >> lines) | (ALL_ROWS << kept)) & ALL_ROWS;
+        pending_scroll += lines;
+        if (pending_scroll > SCREEN_HEIGHT) pending_scroll = SCREEN_HEIGHT;
+
+        for (int y = kept; y < SCREEN_HEIGHT; y++)
+            clear_rows(row_address(y), 1);
+    } else {
+        vga_scroll_rows(lines);
+        clear_rows(vga_row(kept), lines);
+    }
+
+    cursor_y -= lines;
+}
+
+/**
+ * Bring VGA memory up to date with the shadow buffer. Pending scrolls are
+ * applied first and then only the dirty rows are copied.
+*/
+static void flush_shadow()
+{
+    uint32_t dirty = dirty_rows;
+    int lines = pending_scroll;
+    dirty_rows = 0;
+    pending_scroll = 0;
+
+    // If every row is being redrawn there is no need to move anything
+    if (lines > 0 && dirty != ALL_ROWS)
+        vga_scroll_rows(lines);
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        if (dirty & (1u << y))
+            copy_rows(vga_row(y), row_address(y), 1);
+    }
+
+    if (cursor_moved || lines > 0) {
+        cursor_moved = false;
+        update_cursor();
+    }
+}
+
 /**
  * Output a character to the screen. Interpret '\n', '\r', and 't'.
  * The cursor position is updated but the visual is not.
@@ -57,7 +230,9 @@ static void put_char(char c)
         break;
     case '\b':
         cursor_x -= 1;
-        if (cursor_x < 0) {
+        if (cursor_x < 0 && cursor_y == 0) {
+            cursor_x = 0;
+        } else if (cursor_x < 0) {
             cursor_x = SCREEN_WIDTH-1;
             cursor_y--;
             while(cursor_x > 0 && get_char(cursor_x, cursor_y) == '\0')
@@ -81,7 +256,7 @@ static void put_char(char c)
     }
 
     if (cursor_y >= SCREEN_HEIGHT) {
-        vga_scrollback(1);
+        scroll(1);
     }
 }
 
@@ -90,15 +265,26 @@ static void put_char(char c)
 */
 void vga_clear_screen() 
 {
-    for (int y=0; y<SCREEN_HEIGHT; y++) {
-        for (int x=0; x<SCREEN_WIDTH; x++) {
-            set_char(x, y, '\0');
-        }
+    uint32_t flags = spin_lock_irqsave(&vga_lock);
+    rendering = true;
+
+    origin_row = 0;
+    clear_rows(vga_row(0), SCREEN_HEIGHT);
+    update_start_address();
+
+    if (shadowed) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++)
+            clear_rows(row_address(y), 1);
+        dirty_rows = 0;
+        pending_scroll = 0;
     }
-    
+
     cursor_x = 0;
     cursor_y = 0;
     update_cursor();
+
+    rendering = false;
+    spin_unlock_irqrestore(&vga_lock, flags);
 }
 
 /**
@@ -106,20 +292,77 @@ void vga_clear_screen()
 */
 void vga_scrollback(int lines) 
 {
-    for (int y = lines; y < SCREEN_HEIGHT; y++) {
-        for (int x = 0; x < SCREEN_WIDTH; x++) {
-            set_char(x, y-lines, get_char(x, y));
-        }
-    }
+    uint32_t flags = spin_lock_irqsave(&vga_lock);
+    rendering = true;
+    scroll(lines);
+    move_cursor();
+    rendering = false;
+    spin_unlock_irqrestore(&vga_lock, flags);
+}
 
-    for (int y = SCREEN_HEIGHT-lines; y < SCREEN_HEIGHT; y++) {
-        for (int x = 0; x < SCREEN_WIDTH; x++) {
-            set_char(x, y, '\0');
-        }
+/**
+ * Enable or disable scrolling by moving the CRTC start address. The visible
+ * rows are moved to the start of the buffer either way.
+*/
+void vga_set_hardware_scroll(bool enabled)
+{
+    vga_flush();
+    rendering = true;
+
+    if (origin_row != 0) {
+        copy_rows(screen_buffer, vga_row(0), SCREEN_HEIGHT);
+        origin_row = 0;
+        update_start_address();
     }
 
-    cursor_y -= lines;
+    hardware_scroll = enabled;
     update_cursor();
+
+    rendering = false;
+}
+
+/**
+ * Enable or disable rendering into the RAM shadow buffer. When disabled
+ * every write goes straight to VGA memory.
+*/
+void vga_set_shadow_buffer(bool enabled)
+{
+    if (enabled == shadowed) return;
+    vga_flush();
+    rendering = true;
+
+    if (enabled) {
+        // Start the shadow from what is on the screen
+        shadow_top = 0;
+        for (int y = 0; y < SCREEN_HEIGHT; y++)
+            copy_rows(shadow + y * SCREEN_WIDTH, vga_row(y), 1);
+        dirty_rows = 0;
+        pending_scroll = 0;
+    }
+
+    shadowed = enabled;
+    rendering = false;
+}
+
+/**
+ * Copy the dirty rows of the shadow buffer to VGA memory. Does nothing if a
+ * write is in progress, so it is safe to call from an interrupt handler; the
+ * rows will be copied at the next flush.
+*/
+void vga_flush()
+{
+    if (!shadowed || rendering) return;
+
+    uint32_t flags = save_and_disable_interrupts();
+    if (!spin_trylock(&vga_lock)) {
+        restore_interrupts(flags);
+        return;
+    }
+
+    rendering = true;
+    flush_shadow();
+    rendering = false;
+    spin_unlock_irqrestore(&vga_lock, flags);
 }
 
 /**
@@ -127,8 +370,23 @@ void vga_scrollback(int lines)
 */
 void vga_putc(char c) 
 {
-    put_char(c);
-    update_cursor();
+    vga_write(&c, 1);
 }
 
-
+/**
+ * Output [size] characters from [data] to the screen. The hardware cursor is
+ * only updated once after the whole buffer has been rendered. When shadowed
+ * only the RAM shadow is written; VGA memory is updated by vga_flush.
+ * The lock is held with interrupts off so a preempting thread or another CPU
+ * can not interleave its output or move the cursor half way through.
+*/
+void vga_write(const char *data, size_t size)
+{
+    uint32_t flags = spin_lock_irqsave(&vga_lock);
+    rendering = true;
+    for (size_t i=0; i<size; i++)
+        put_char(data[i]);
+    move_cursor();
+    rendering = false;
+    spin_unlock_irqrestore(&vga_lock, flags);
+}
@@ -1,5 +1,12 @@
 #pragma once
 
-void vga_scrollback();
+#include <stdbool.h>
+#include <stddef.h>
+
+void vga_scrollback(int lines);
 void vga_clear_screen();
-void vga_putc(char c);
\ No newline at end of file
+void vga_putc(char c);
+void vga_write(const char *data, size_t size);
+void vga_set_hardware_scroll(bool enabled);
+void vga_set_shadow_buffer(bool enabled);
+void vga_flush();
\ No newline at end of file
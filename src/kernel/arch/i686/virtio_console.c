@@ -0,0 +1,523 @@
+#include "virtio_console.h"
+
+#include <arch/i686/io.h>
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Size of each port's transmit ring buffer. Must be a power of 2.
+#define TX_RING_SIZE 16384
+
+#define VRING_ALIGN 4096
+
+// The device only looks at the control queue this many times while the ports
+// are being set up before giving up on them
+#define CONTROL_POLL_LIMIT 100000
+
+static enum {
+    REG_DEVICE_FEATURES = 0x00,
+    REG_GUEST_FEATURES  = 0x04,
+    REG_QUEUE_ADDRESS   = 0x08,
+    REG_QUEUE_SIZE      = 0x0C,
+    REG_QUEUE_SELECT    = 0x0E,
+    REG_QUEUE_NOTIFY    = 0x10,
+    REG_DEVICE_STATUS   = 0x12,
+    REG_ISR_STATUS      = 0x13,
+    REG_MAX_PORTS       = 0x18      // Console config, without MSI-X
+} VIRTIO_REGISTERS;
+
+static enum {
+    STATUS_ACKNOWLEDGE  = 0x01,
+    STATUS_DRIVER       = 0x02,
+    STATUS_DRIVER_OK    = 0x04,
+    STATUS_FAILED       = 0x80,
+
+    FEATURE_MULTIPORT   = 1 << 1,
+
+    DESC_F_WRITE        = 0x2,
+    AVAIL_F_NO_INTERRUPT = 0x1,
+    USED_F_NO_NOTIFY    = 0x1
+} VIRTIO_BITS;
+
+static enum {
+    QUEUE_PORT0_TX      = 1,
+    QUEUE_CONTROL_RX    = 2,
+    QUEUE_CONTROL_TX    = 3
+} VIRTIO_QUEUES;
+
+static enum {
+    CONTROL_DEVICE_READY    = 0,
+    CONTROL_DEVICE_ADD      = 1,
+    CONTROL_DEVICE_REMOVE   = 2,
+    CONTROL_PORT_READY      = 3,
+    CONTROL_CONSOLE_PORT    = 4,
+    CONTROL_RESIZE          = 5,
+    CONTROL_PORT_OPEN       = 6,
+    CONTROL_PORT_NAME       = 7
+} VIRTIO_CONTROL_EVENTS;
+
+typedef struct {
+    uint64_t address;
+    uint32_t length;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) VirtqDesc;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t index;
+    uint16_t ring[];
+} __attribute__((packed)) VirtqAvail;
+
+typedef struct {
+    uint32_t id;
+    uint32_t length;
+} __attribute__((packed)) VirtqUsedElem;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t index;
+    VirtqUsedElem ring[];
+} __attribute__((packed)) VirtqUsed;
+
+typedef struct {
+    uint32_t id;
+    uint16_t event;
+    uint16_t value;
+} __attribute__((packed)) ControlMessage;
+
+typedef struct {
+    uint16_t index;
+    uint16_t size;
+    volatile VirtqDesc *desc;
+    volatile VirtqAvail *avail;
+    volatile VirtqUsed *used;
+    uint16_t next_avail;        // Our copy of avail->index
+    uint16_t last_used;         // The next used entry to look at
+    uint16_t free_head;         // Free descriptors, chained through next
+    uint16_t free_count;
+} Virtqueue;
+
+typedef struct {
+    bool ready;
+    bool host_connected;
+    Virtqueue tx;
+    uint32_t *lengths;          // Bytes covered by each descriptor
+    bool *completed;            // Descriptors the device has returned
+    uint16_t *order;            // Descriptors in the order they were submitted
+    uint16_t submitted;         // Descriptors added to order
+    uint16_t retired;           // Descriptors whose bytes count towards done
+    uint8_t *ring;
+    uint32_t head;              // Bytes queued
+    uint32_t sent;              // Bytes handed to the device
+    uint32_t done;              // Bytes the device has finished with
+} Port;
+
+static uint16_t io_base;
+static bool multiport = false;
+static Port ports[VIRTIO_CONSOLE_PORT_COUNT];
+
+static Virtqueue control_rx;
+static Virtqueue control_tx;
+static ControlMessage *control_in;
+static ControlMessage *control_out;
+
+static void barrier() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+/**
+ * Allocate the legacy split ring for queue [index] and give it to the device.
+ * Interrupts are suppressed for every queue; completions are picked up by
+ * polling the used ring when the driver next needs space.
+ *
+ * Parameters:
+ *   queue: The queue to initialize
+ *   index: The index of the queue on the device
+ *
+ * Returns:
+ *   Whether the queue exists and was set up
+*/
+static bool setup_queue(Virtqueue *queue, uint16_t index) {
+    out_word(io_base + REG_QUEUE_SELECT, index);
+    uint16_t size = in_word(io_base + REG_QUEUE_SIZE);
+    if (size == 0) return false;
+
+    size_t avail_end = sizeof(VirtqDesc) * size + sizeof(uint16_t) * (3 + size);
+    size_t used_offset = align_up(avail_end, VRING_ALIGN);
+    size_t total = used_offset +
+        align_up(sizeof(uint16_t) * 3 + sizeof(VirtqUsedElem) * size, VRING_ALIGN);
+
+    uint8_t *memory = aligned_alloc(VRING_ALIGN, total);
+    if (memory == NULL) return false;
+    memset(memory, 0, total);
+
+    queue->index = index;
+    queue->size = size;
+    queue->desc = (VirtqDesc *)memory;
+    queue->avail = (VirtqAvail *)(memory + sizeof(VirtqDesc) * size);
+    queue->used = (VirtqUsed *)(memory + used_offset);
+    queue->next_avail = 0;
+    queue->last_used = 0;
+    queue->avail->flags = AVAIL_F_NO_INTERRUPT;
+
+    for (uint16_t i = 0; i < size; i++) queue->desc[i].next = i + 1;
+    queue->free_head = 0;
+    queue->free_count = size;
+
+    // Memory is identity mapped so the address is the physical address
+    out_double(io_base + REG_QUEUE_ADDRESS, (uintptr_t)memory / VRING_ALIGN);
+    return true;
+}
+
+/**
+ * Take a descriptor off the free list.
+ *
+ * Returns:
+ *   Whether one was free, its index is stored in [desc]
+*/
+static bool queue_alloc(Virtqueue *queue, uint16_t *desc) {
+    if (queue->free_count == 0) return false;
+
+    *desc = queue->free_head;
+    queue->free_head = queue->desc[*desc].next;
+    queue->free_count--;
+    return true;
+}
+
+/**
+ * Put descriptor [desc], which the device has finished with, back on the free
+ * list.
+*/
+static void queue_free(Virtqueue *queue, uint16_t desc) {
+    queue->desc[desc].next = queue->free_head;
+    queue->free_head = desc;
+    queue->free_count++;
+}
+
+/**
+ * Make descriptor [desc] available to the device. The device is not told
+ * until queue_kick is called.
+*/
+static void queue_push(Virtqueue *queue, uint16_t desc) {
+    queue->avail->ring[queue->next_avail % queue->size] = desc;
+    barrier();
+    queue->next_avail++;
+    queue->avail->index = queue->next_avail;
+}
+
+static void queue_kick(Virtqueue *queue) {
+    barrier();
+    if ((queue->used->flags & USED_F_NO_NOTIFY) == 0)
+        out_word(io_base + REG_QUEUE_NOTIFY, queue->index);
+}
+
+/**
+ * Get the next descriptor the device has finished with.
+ *
+ * Returns:
+ *   Whether there was one, its index is stored in [desc]
+*/
+static bool queue_pop_used(Virtqueue *queue, uint16_t *desc) {
+    barrier();
+    if (queue->last_used == queue->used->index) return false;
+
+    *desc = queue->used->ring[queue->last_used % queue->size].id;
+    queue->last_used++;
+    return true;
+}
+
+static void send_control(uint32_t id, uint16_t event, uint16_t value) {
+    uint16_t desc;
+    while (queue_pop_used(&control_tx, &desc)) queue_free(&control_tx, desc);
+
+    // The device consumes control messages as soon as it is notified
+    while (!queue_alloc(&control_tx, &desc)) {
+        while (queue_pop_used(&control_tx, &desc)) queue_free(&control_tx, desc);
+    }
+
+    control_out[desc] = (ControlMessage){ id, event, value };
+    control_tx.desc[desc].address = (uintptr_t)&control_out[desc];
+    control_tx.desc[desc].length = sizeof(ControlMessage);
+    control_tx.desc[desc].flags = 0;
+
+    queue_push(&control_tx, desc);
+    queue_kick(&control_tx);
+}
+
+static bool setup_port(int id) {
+    Port *port = &ports[id];
+    uint16_t queue = id == 0 ? QUEUE_PORT0_TX : id * 2 + 3;
+
+    if (!setup_queue(&port->tx, queue)) return false;
+
+    port->lengths = calloc(port->tx.size, sizeof(uint32_t));
+    port->completed = calloc(port->tx.size, sizeof(bool));
+    port->order = calloc(port->tx.size, sizeof(uint16_t));
+    port->ring = malloc(TX_RING_SIZE);
+    if (port->lengths == NULL || port->completed == NULL ||
+        port->order == NULL || port->ring == NULL
+    ) return false;
+
+    port->submitted = 0;
+    port->retired = 0;
+    port->head = 0;
+    port->sent = 0;
+    port->done = 0;
+    return true;
+}
+
+static void handle_control(ControlMessage *message) {
+    bool known = message->id < VIRTIO_CONSOLE_PORT_COUNT &&
+        ports[message->id].tx.size != 0;
+
+    switch (message->event) {
+    case CONTROL_DEVICE_ADD:
+        send_control(message->id, CONTROL_PORT_READY, known);
+        if (known) {
+            send_control(message->id, CONTROL_PORT_OPEN, 1);
+            ports[message->id].ready = true;
+        }
+        break;
+    case CONTROL_DEVICE_REMOVE:
+        if (known) ports[message->id].ready = false;
+        break;
+    case CONTROL_PORT_OPEN:
+        if (known) ports[message->id].host_connected = message->value;
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * Handle every control message the device has sent and give the buffers
+ * back to it.
+ *
+ * Returns:
+ *   The number of messages handled
+*/
+static int process_control() {
+    if (!multiport) return 0;
+
+    int count = 0;
+    uint16_t desc;
+    while (queue_pop_used(&control_rx, &desc)) {
+        handle_control(&control_in[desc]);
+        queue_push(&control_rx, desc);
+        count++;
+    }
+
+    if (count > 0) queue_kick(&control_rx);
+    return count;
+}
+
+static bool setup_control() {
+    if (!setup_queue(&control_rx, QUEUE_CONTROL_RX)) return false;
+    if (!setup_queue(&control_tx, QUEUE_CONTROL_TX)) return false;
+
+    control_in = calloc(control_rx.size, sizeof(ControlMessage));
+    control_out = calloc(control_tx.size, sizeof(ControlMessage));
+    if (control_in == NULL || control_out == NULL) return false;
+
+    // The receive buffers stay with the device and are never freed
+    uint16_t desc;
+    while (queue_alloc(&control_rx, &desc)) {
+        control_rx.desc[desc].address = (uintptr_t)&control_in[desc];
+        control_rx.desc[desc].length = sizeof(ControlMessage);
+        control_rx.desc[desc].flags = DESC_F_WRITE;
+        queue_push(&control_rx, desc);
+    }
+    queue_kick(&control_rx);
+    return true;
+}
+
+/**
+ * Account for the buffers the device has finished sending. The device may
+ * return them in any order, but ring space is only released up to the
+ * oldest buffer still in flight, so its bytes are never overwritten.
+*/
+static void port_reclaim(Port *port) {
+    uint16_t desc;
+    while (queue_pop_used(&port->tx, &desc)) port->completed[desc] = true;
+
+    while (port->retired != port->submitted) {
+        desc = port->order[port->retired % port->tx.size];
+        if (!port->completed[desc]) break;
+
+        port->completed[desc] = false;
+        port->done += port->lengths[desc];
+        port->retired++;
+        queue_free(&port->tx, desc);
+    }
+}
+
+/**
+ * Hand everything queued in the ring to the device, as at most two
+ * descriptors when the data wraps around the end of the ring.
+*/
+static void port_submit(Port *port) {
+    bool pushed = false;
+
+    uint16_t desc;
+    while (port->sent != port->head && queue_alloc(&port->tx, &desc)) {
+        uint32_t start = port->sent & (TX_RING_SIZE - 1);
+        uint32_t length = port->head - port->sent;
+        if (length > TX_RING_SIZE - start) length = TX_RING_SIZE - start;
+
+        port->tx.desc[desc].address = (uintptr_t)(port->ring + start);
+        port->tx.desc[desc].length = length;
+        port->tx.desc[desc].flags = 0;
+        port->lengths[desc] = length;
+        port->order[port->submitted++ % port->tx.size] = desc;
+
+        queue_push(&port->tx, desc);
+        port->sent += length;
+        pushed = true;
+    }
+
+    if (pushed) queue_kick(&port->tx);
+}
+
+bool virtio_console_port_ready(VirtioConsolePort port) {
+    return port < VIRTIO_CONSOLE_PORT_COUNT && ports[port].ready;
+}
+
+size_t virtio_console_write(VirtioConsolePort id, const void *data, size_t size) {
+    if (!virtio_console_port_ready(id)) return 0;
+
+    Port *port = &ports[id];
+    const uint8_t *bytes = data;
+    size_t written = 0;
+
+    uint32_t flags = save_and_disable_interrupts();
+    process_control();
+
+    while (written < size) {
+        port_reclaim(port);
+
+        uint32_t space = TX_RING_SIZE - (port->head - port->done);
+        if (space == 0) {
+            // Let the device drain what is queued and wait for it
+            port_submit(port);
+            continue;
+        }
+
+        uint32_t start = port->head & (TX_RING_SIZE - 1);
+        uint32_t length = size - written;
+        if (length > space) length = space;
+        if (length > TX_RING_SIZE - start) length = TX_RING_SIZE - start;
+
+        memcpy(port->ring + start, bytes + written, length);
+        port->head += length;
+        written += length;
+    }
+
+    port_submit(port);
+    restore_interrupts(flags);
+
+    return written;
+}
+
+void virtio_console_flush(VirtioConsolePort id) {
+    if (!virtio_console_port_ready(id)) return;
+
+    Port *port = &ports[id];
+    uint32_t flags = save_and_disable_interrupts();
+
+    while (port->done != port->head) {
+        port_submit(port);
+        port_reclaim(port);
+    }
+
+    restore_interrupts(flags);
+}
+
+void virtio_console_initialize(PCI_Device *dev) {
+    if (io_base != 0) return;
+
+    uint32_t bar0 = pci_dev_read_config_reg(dev, 0x10);
+    if ((bar0 & 0x1) == 0) {
+        log_warn("virtio-console", "BAR0 is not an I/O BAR");
+        return;
+    }
+
+    io_base = bar0 & 0xFFFC;
+    pci_dev_enable_bus_master(dev);
+
+    // Reset the device and tell it a driver has found it
+    out_byte(io_base + REG_DEVICE_STATUS, 0);
+    out_byte(io_base + REG_DEVICE_STATUS, STATUS_ACKNOWLEDGE);
+    out_byte(io_base + REG_DEVICE_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+
+    uint32_t features = in_double(io_base + REG_DEVICE_FEATURES);
+    features &= FEATURE_MULTIPORT;
+    out_double(io_base + REG_GUEST_FEATURES, features);
+    multiport = features & FEATURE_MULTIPORT;
+
+    uint32_t max_ports = multiport ? in_double(io_base + REG_MAX_PORTS) : 1;
+    if (max_ports > VIRTIO_CONSOLE_PORT_COUNT)
+        max_ports = VIRTIO_CONSOLE_PORT_COUNT;
+
+    bool ok = true;
+    for (uint32_t i = 0; i < max_ports && ok; i++)
+        ok = setup_port(i);
+    if (ok && multiport)
+        ok = setup_control();
+
+    if (!ok) {
+        out_byte(io_base + REG_DEVICE_STATUS, STATUS_FAILED);
+        log_error("virtio-console", "Could not set up the queues");
+        return;
+    }
+
+    out_byte(io_base + REG_DEVICE_STATUS,
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK
+    );
+
+    if (multiport) {
+        // The device announces its ports in reply to DEVICE_READY
+        send_control(0, CONTROL_DEVICE_READY, 1);
+        for (int i = 0; i < CONTROL_POLL_LIMIT; i++) {
+            if (process_control() == 0 && ports[0].ready) break;
+        }
+    } else {
+        ports[0].ready = true;
+    }
+
+    log_info("virtio-console", "Initialized [io=%#x, multiport=%d, log=%d, export=%d]",
+        io_base, multiport, ports[VIRTIO_CONSOLE_PORT_LOG].ready,
+        ports[VIRTIO_CONSOLE_PORT_EXPORT].ready
+    );
+}
+
+static bool probe(PCI_Device *dev) {
+    // Only the first console is driven
+    if (io_base != 0) return false;
+
+    virtio_console_initialize(dev);
+    return virtio_console_port_ready(VIRTIO_CONSOLE_PORT_LOG);
+}
+
+static const PCI_DeviceId virtio_console_ids[] = {
+    PCI_DEVICE(VIRTIO_PCI_VENDOR, VIRTIO_CONSOLE_DEVICE),
+    PCI_DEVICE_END
+};
+
+// Probed on the boot CPU, the log starts writing to it as soon as it is up
+static const PCI_Driver driver = {
+    .name = "virtio-console",
+    .ids = virtio_console_ids,
+    .probe = &probe,
+    .parallel = false
+};
+
+const PCI_Driver* virtio_console_get_pci_driver() {
+    return &driver;
+}
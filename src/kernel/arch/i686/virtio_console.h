@@ -0,0 +1,57 @@
+#pragma once
+
+#include <arch/i686/pci.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define VIRTIO_PCI_VENDOR       0x1AF4
+#define VIRTIO_CONSOLE_DEVICE   0x1003  // Legacy / transitional device id
+
+typedef enum {
+    VIRTIO_CONSOLE_PORT_LOG     = 0,    // The console, used for text output
+    VIRTIO_CONSOLE_PORT_EXPORT  = 1,    // Bulk binary data such as traces
+    VIRTIO_CONSOLE_PORT_COUNT
+} VirtioConsolePort;
+
+/**
+ * Initialize a legacy virtio-console PCI device. Port 0 is the console and,
+ * when the device supports multiple ports, port 1 is used for binary export.
+ *
+ * Parameters:
+ *   dev: The PCI device to initialize
+*/
+void virtio_console_initialize(PCI_Device *dev);
+
+/**
+ * Returns:
+ *   The driver for virtio-console devices, to register with
+ *   pci_register_driver
+*/
+const PCI_Driver* virtio_console_get_pci_driver();
+
+/**
+ * Returns:
+ *   Whether [port] has been initialized and can be written to
+*/
+bool virtio_console_port_ready(VirtioConsolePort port);
+
+/**
+ * Queue [size] bytes from [data] on [port] and hand them to the host. The
+ * bytes are copied into the port's transmit ring so whole buffers are passed
+ * to the device with a single notification. Only blocks when the ring is
+ * full.
+ *
+ * Parameters:
+ *   port: The port to write to
+ *   data: The bytes to send
+ *   size: The number of bytes to send
+ *
+ * Returns:
+ *   The number of bytes queued, 0 if the port is not ready
+*/
+size_t virtio_console_write(VirtioConsolePort port, const void *data, size_t size);
+
+/**
+ * Wait until the host has consumed everything queued on [port].
+*/
+void virtio_console_flush(VirtioConsolePort port);
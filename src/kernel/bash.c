@@ -1,10 +1,18 @@
 #include "bash.h"
 
 #include <stdio.h>
+#include "clock.h"
+#include "debug.h"
+#include "events.h"
 #include "keyboard.h"
+#include "task.h"
+#include "tasklet.h"
+#include "timer.h"
 #include <string.h>
 #include <stdlib.h>
 #include <arch/i686/io.h>
+#include <arch/i686/irq.h>
+#include <arch/i686/isr.h>
 
 static char command[80];
 static uint8_t command_length;
@@ -65,6 +73,93 @@ static void cmd_in(int size) {
     printf("[%#x] -> %#x\n", port, value);
 }
 
+static void cmd_dmesg() {
+    log_dump(stdout);
+}
+
+static void cmd_evstat() {
+    static const char *const names[] = { "high", "normal", "low" };
+
+    printf("class   depth  max  dispatched  dropped  aged  missed  avg lat  max lat\n");
+    for (int i = 0; i < EVENT_PRIORITY_COUNT; i++) {
+        EventClassStats stats;
+        event_get_stats(i, &stats);
+
+        uint64_t average = stats.dispatched == 0 ? 0 : 
+            stats.total_latency / stats.dispatched;
+        printf("%s\t%5u %4u %11u %8u %5u %7u %8llu %8llu\n",
+            names[i], stats.depth, stats.max_depth, stats.dispatched,
+            stats.dropped, stats.aged, stats.missed_deadlines, average,
+            stats.max_latency
+        );
+    }
+
+    TimerIdleStats idle;
+    timer_get_idle_stats(&idle);
+    printf("tickless idle: %u periods, %u woken early, %u ticks skipped\n",
+        idle.entries, idle.early_wakeups, idle.skipped_ticks);
+}
+
+static void cmd_irqoff() {
+    printf("irq      count      avg off ns      max off ns\n");
+    for (int i = 0; i < 16; i++) {
+        IRQStats stats;
+        irq_get_stats(i, &stats);
+        if (stats.count == 0) continue;
+
+        printf("%3d %10u %15llu %15llu\n", i, stats.count,
+            cycles_to_ns(stats.total_off_cycles / stats.count),
+            cycles_to_ns(stats.max_off_cycles));
+    }
+
+    TaskletStats tasklets;
+    tasklet_get_stats(&tasklets);
+    uint64_t average = tasklets.runs == 0 ? 0 :
+        tasklets.total_cycles / tasklets.runs;
+    printf("tasklets: %u runs, %u deferred, avg %llu ns, max %llu ns\n",
+        tasklets.runs, tasklets.deferred, cycles_to_ns(average),
+        cycles_to_ns(tasklets.max_cycles));
+}
+
+static void cmd_irqstat() {
+    uint32_t seconds = timer_ticks() / timer_frequency();
+    if (seconds == 0) seconds = 1;
+
+    printf("vec      count  per sec      avg ns      max ns\n");
+    for (int i = 0; i < 256; i++) {
+        ISR_Stats stats;
+        isr_get_stats(i, &stats);
+        if (stats.count == 0) continue;
+
+        printf("%3d %10u %8u %11llu %11llu\n", i, stats.count,
+            stats.count / seconds,
+            cycles_to_ns(stats.total_cycles / stats.count),
+            cycles_to_ns(stats.max_cycles));
+
+        // Histogram of handler times as log2(cycles):count
+        printf("   ");
+        for (int j = 0; j < ISR_HISTOGRAM_BUCKETS; j++)
+            if (stats.histogram[j] != 0)
+                printf(" %d:%u", j, stats.histogram[j]);
+        printf("\n");
+    }
+
+    IRQStats irq7, irq15;
+    irq_get_stats(7, &irq7);
+    irq_get_stats(15, &irq15);
+    printf("spurious: IRQ 7 %u, IRQ 15 %u\n", irq7.spurious, irq15.spurious);
+}
+
+static void cmd_taskstat() {
+    printf("cpu  executed    stolen  overflowed\n");
+    for (int i = 0; i < task_cpu_count(); i++) {
+        TaskStats stats;
+        task_get_stats(i, &stats);
+        printf("%3d %9u %9u %11u\n",
+            i, stats.executed, stats.stolen, stats.overflowed);
+    }
+}
+
 static void cmd_unkown() {
     printf("Invalid Command\n");
 }
@@ -82,6 +177,11 @@ static void process_command() {
     else if (memcmp(command, "inb ", 4) == 0) cmd_in(8);
     else if (memcmp(command, "inw ", 4) == 0) cmd_in(8);
     else if (memcmp(command, "ind ", 4) == 0) cmd_in(8);
+    else if (memcmp(command, "dmesg", 5) == 0) cmd_dmesg();
+    else if (memcmp(command, "evstat", 6) == 0) cmd_evstat();
+    else if (memcmp(command, "taskstat", 8) == 0) cmd_taskstat();
+    else if (memcmp(command, "irqoff", 6) == 0) cmd_irqoff();
+    else if (memcmp(command, "irqstat", 7) == 0) cmd_irqstat();
     else cmd_unkown();
 
     for (; command_length > 0; command_length--)
@@ -107,7 +207,6 @@ static void keypress_handler(void *args) {
             }
         }
     }
-    free(event);
 }
 
 void bash_initialize() {
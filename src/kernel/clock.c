@@ -0,0 +1,106 @@
+#include "clock.h"
+
+#include <arch/i686/acpi.h>
+#include <arch/i686/io.h>
+#include <arch/i686/pit.h>
+#include <cpuid.h>
+#include "debug.h"
+
+static enum {
+    CPUID_POWER_MANAGEMENT      = 0x80000007,
+    CPUID_EDX_INVARIANT_TSC     = 0x100
+} CPUID_VALUES;
+
+static uint64_t tsc_frequency = 0;
+static uint64_t tsc_base = 0;
+
+// ns = cycles * mult >> shift, with shift as large as mult allows
+static uint32_t mult = 0;
+static uint32_t shift = 0;
+
+/**
+ * Returns:
+ *   The TSC frequency in Hz measured against the power management timer
+*/
+static uint64_t measure_pm_timer() {
+    uint32_t mask = acpi_pm_timer_mask();
+    uint32_t period =
+        (uint64_t)ACPI_PM_TIMER_FREQUENCY * CLOCK_CALIBRATION_MS / 1000;
+
+    // Start on an edge of the timer so the first reading is not stale
+    uint32_t first = acpi_pm_timer_read();
+    uint32_t start;
+    while ((start = acpi_pm_timer_read()) == first);
+    uint64_t tsc_start = read_tsc();
+
+    uint32_t end;
+    do {
+        end = acpi_pm_timer_read();
+    } while (((end - start) & mask) < period);
+    uint64_t tsc_end = read_tsc();
+
+    return (tsc_end - tsc_start) * ACPI_PM_TIMER_FREQUENCY /
+        ((end - start) & mask);
+}
+
+/**
+ * Returns:
+ *   The TSC frequency in Hz measured against channel 2 of the PIT
+*/
+static uint64_t measure_pit() {
+    uint16_t count = (uint64_t)PIT_BASE_FREQUENCY * CLOCK_CALIBRATION_MS / 1000;
+    return pit_measure_tsc(count) * PIT_BASE_FREQUENCY / count;
+}
+
+static bool has_invariant_tsc() {
+    // Returns 0 when the extended leaves are not supported at all
+    if (__get_cpuid_max(0x80000000, NULL) < CPUID_POWER_MANAGEMENT) return false;
+
+    unsigned int edx, unused;
+    if (!__get_cpuid(CPUID_POWER_MANAGEMENT, &unused, &unused, &unused, &edx))
+        return false;
+    return (edx & CPUID_EDX_INVARIANT_TSC) != 0;
+}
+
+void clock_initialize() {
+    bool pm_timer = acpi_pm_timer_present();
+
+    // An SMI or a slow port read only ever makes a run look longer, which
+    // overestimates the frequency, so keep the lowest
+    uint32_t flags = save_and_disable_interrupts();
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < CLOCK_CALIBRATION_RUNS; i++) {
+        uint64_t hz = pm_timer ? measure_pm_timer() : measure_pit();
+        if (hz < best) best = hz;
+    }
+    restore_interrupts(flags);
+
+    if (best == 0) panic("Clock", "The TSC is not counting");
+
+    // Pick the largest shift that keeps mult in 32 bits for precision
+    shift = 32;
+    while (shift > 0 && (NS_PER_SECOND << shift) / best > UINT32_MAX) shift--;
+    mult = (NS_PER_SECOND << shift) / best;
+
+    tsc_frequency = best;
+    tsc_base = read_tsc();
+
+    log_info("Clock", "TSC at %llu kHz from the %s%s", best / 1000,
+        pm_timer ? "ACPI PM timer" : "PIT",
+        has_invariant_tsc() ? ", invariant" : "");
+}
+
+uint64_t clock_tsc_frequency() {
+    return tsc_frequency;
+}
+
+uint64_t cycles_to_ns(uint64_t cycles) {
+    // Split the cycles so every product fits in 64 bits
+    uint64_t low = (uint64_t)(uint32_t)cycles * mult;
+    uint64_t high = (uint64_t)(uint32_t)(cycles >> 32) * mult;
+    return (low >> shift) + (high << (32 - shift));
+}
+
+uint64_t ktime_ns() {
+    return cycles_to_ns(read_tsc() - tsc_base);
+}
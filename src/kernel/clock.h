@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NS_PER_SECOND 1000000000ull
+
+// Calibration measures this many periods and keeps the best
+#define CLOCK_CALIBRATION_RUNS 3
+#define CLOCK_CALIBRATION_MS 10
+
+/**
+ * Measure the TSC frequency against the ACPI power management timer, or
+ * channel 2 of the PIT when there is none. Must be called after
+ * acpi_initialize.
+*/
+void clock_initialize();
+
+/**
+ * Returns:
+ *   The calibrated TSC frequency in Hz
+*/
+uint64_t clock_tsc_frequency();
+
+/**
+ * Convert a number of TSC cycles to nanoseconds. Only uses multiplications,
+ * so it is cheap enough to call from interrupt handlers.
+ * 
+ * Parameters:
+ *   cycles: A difference between two read_tsc values
+ * 
+ * Returns:
+ *   The time in nanoseconds, 0 before the clock is calibrated
+*/
+uint64_t cycles_to_ns(uint64_t cycles);
+
+/**
+ * Returns:
+ *   Nanoseconds since the clock was calibrated. The clock is monotonic on
+ *   any one CPU. Different CPUs agree as far as their TSCs are in step.
+*/
+uint64_t ktime_ns();
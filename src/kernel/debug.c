@@ -1,6 +1,9 @@
 #include "debug.h"
 
 #include <arch/i686/io.h>
+#include "clock.h"
+#include <arch/i686/virtio_console.h>
+#include <stdbool.h>
 #include <stdio.h>
 
 static const char* const log_severity_colors[] = {
@@ -13,6 +16,191 @@ static const char* const log_severity_colors[] = {
 
 static const char* const color_reset = "\033[0;0;0m";
 
+// Padded to the same width since format_print ignores the width of %s
+static const char* const log_level_names[] = {
+    [LVL_DEBUG]         ="DEBUG",
+    [LVL_INFO]          ="INFO ",
+    [LVL_WARN]          ="WARN ",
+    [LVL_ERROR]         ="ERROR",
+    [LVL_CRITICAL]      ="CRIT ",
+};
+
+typedef struct {
+    uint32_t sequence;      // Ring slot + 1 once the entry is complete
+    uint64_t timestamp;     // TSC value when the message was logged
+    const char *module;
+    uint8_t level;
+    char text[KMSG_TEXT_SIZE];
+} KmsgEntry;
+
+static KmsgEntry kmsg_ring[KMSG_RING_SIZE];
+static uint32_t kmsg_head = 0;      // Next entry to be claimed by a writer
+static uint32_t kmsg_rendered = 0;  // Next entry to be rendered
+static DebugLevel console_level = LVL_INFO;
+
+static LogMode log_mode = LOG_MODE_TEXT;
+
+static LogRecord log_ring[LOG_RING_SIZE];
+static uint32_t log_head = 0;      // Next slot to be claimed by a writer
+static uint32_t log_tail = 0;      // Next slot to be written to stddbg
+
+// Records are handed to the host this many at a time
+#define LOG_FLUSH_BATCH 8
+
+// Number of format strings whose argument count is remembered. Must be a
+// power of 2.
+#define ARG_CACHE_SIZE 64
+
+// Each entry packs a format address with its argument word count so it can
+// be read and written atomically. Formats above 256MiB are not cached.
+#define ARG_CACHE_WORD_BITS 4
+#define ARG_CACHE_MAX_FORMAT (1u << (32 - ARG_CACHE_WORD_BITS))
+
+static uint32_t arg_cache[ARG_CACHE_SIZE];
+
+static bool is_format_modifier(char c) {
+    switch (c) {
+    case '-': case '+': case ' ': case '#': case '\'': case '.': case '*':
+        return true;
+    default:
+        return c >= '0' && c <= '9';
+    }
+}
+
+/**
+ * Determine the number of 32-bit argument words that [format] consumes.
+ * long long arguments take two words, everything else takes one.
+*/
+static int count_arg_words(const char *format) {
+    int words = 0;
+    while (*format) {
+        if (*format++ != '%') continue;
+
+        // Flags, width and precision. '*' consumes an int argument.
+        while (*format && is_format_modifier(*format)) {
+            if (*format == '*') words++;
+            format++;
+        }
+
+        int longs = 0;
+        while (*format == 'l' || *format == 'h') {
+            if (*format == 'l') longs++;
+            format++;
+        }
+
+        switch (*format) {
+        case '\0':
+            return words;
+        case '%':
+            break;
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+            words += longs >= 2 ? 2 : 1;
+            break;
+        default:
+            words++;
+        }
+        format++;
+    }
+    return words;
+}
+
+/**
+ * Get the number of argument words [format] consumes, clamped to
+ * LOG_RECORD_MAX_ARGS. Format strings are literals that are logged many
+ * times, so the count is cached by address instead of parsing the string on
+ * every call.
+*/
+static int get_arg_words(const char *format) {
+    uintptr_t address = (uintptr_t)format;
+    if (address >= ARG_CACHE_MAX_FORMAT) {
+        int words = count_arg_words(format);
+        return words > LOG_RECORD_MAX_ARGS ? LOG_RECORD_MAX_ARGS : words;
+    }
+
+    uint32_t index = ((address >> 2) ^ (address >> 8)) & (ARG_CACHE_SIZE - 1);
+    uint32_t *entry = &arg_cache[index];
+    uint32_t cached = __atomic_load_n(entry, __ATOMIC_RELAXED);
+    if (cached != 0 && cached >> ARG_CACHE_WORD_BITS == address)
+        return cached & ((1 << ARG_CACHE_WORD_BITS) - 1);
+
+    int words = count_arg_words(format);
+    if (words > LOG_RECORD_MAX_ARGS) words = LOG_RECORD_MAX_ARGS;
+    uint32_t packed = (address << ARG_CACHE_WORD_BITS) | words;
+    __atomic_store_n(entry, packed, __ATOMIC_RELAXED);
+    return words;
+}
+
+/**
+ * Store a message in the binary log ring. Writers claim a slot with an
+ * atomic increment so this is safe to call from interrupt handlers. When the
+ * ring is full the oldest records are overwritten.
+*/
+static void log_binary(
+    const char *module, DebugLevel level, const char *format, va_list args
+) {
+    uint64_t timestamp = read_tsc();
+    uint32_t slot = __atomic_fetch_add(&log_head, 1, __ATOMIC_RELAXED);
+    LogRecord *record = &log_ring[slot & (LOG_RING_SIZE - 1)];
+
+    // Invalidate the slot while it is rewritten so a reader can tell
+    __atomic_store_n(&record->sequence, 0, __ATOMIC_RELEASE);
+
+    int words = get_arg_words(format);
+
+    record->magic = LOG_RECORD_MAGIC;
+    record->timestamp = timestamp;
+    record->module = module;
+    record->format = format;
+    record->level = level;
+    record->arg_words = words;
+    record->dropped = 0;
+
+    // cdecl passes a long long as two consecutive words so they can be
+    // copied a word at a time without knowing the argument types
+    for (int i=0; i<words; i++)
+        record->args[i] = va_arg(args, uint32_t);
+
+    __atomic_store_n(&record->sequence, slot + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Format a message into the kernel message log. Like the binary log, writers
+ * claim an entry with an atomic increment so this is safe to call from
+ * interrupt handlers and the oldest entries are overwritten when it is full.
+*/
+static void log_text(
+    const char *module, DebugLevel level, const char *format, va_list args
+) {
+    uint64_t timestamp = read_tsc();
+    uint32_t slot = __atomic_fetch_add(&kmsg_head, 1, __ATOMIC_RELAXED);
+    KmsgEntry *entry = &kmsg_ring[slot & (KMSG_RING_SIZE - 1)];
+
+    __atomic_store_n(&entry->sequence, 0, __ATOMIC_RELEASE);
+
+    entry->timestamp = timestamp;
+    entry->module = module;
+    entry->level = level;
+    vsnprintf(entry->text, KMSG_TEXT_SIZE, format, args);
+
+    __atomic_store_n(&entry->sequence, slot + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copy the entry at [slot] into [entry] if it is complete and has not been
+ * overwritten.
+ * 
+ * Returns:
+ *   Whether [entry] holds the message logged at [slot]
+*/
+static bool read_kmsg(uint32_t slot, KmsgEntry *entry) {
+    KmsgEntry *source = &kmsg_ring[slot & (KMSG_RING_SIZE - 1)];
+    uint32_t sequence = __atomic_load_n(&source->sequence, __ATOMIC_ACQUIRE);
+    if (sequence != slot + 1) return false;
+
+    *entry = *source;
+    return __atomic_load_n(&source->sequence, __ATOMIC_ACQUIRE) == sequence;
+}
+
 void debug_buffer(const char * restrict msg, const void *buffer, size_t count) {
     fputs(msg, stddbg);
     fprintbuf(stddbg, buffer, count);
@@ -20,22 +208,155 @@ void debug_buffer(const char * restrict msg, const void *buffer, size_t count) {
 }
 
 void logf(const char *module, DebugLevel level, const char *format, ...) {
+    if (level < MIN_LOG_LEVEL) return;
+
     va_list args;
     va_start(args, format);
 
-    if (level < MIN_LOG_LEVEL) return;
-
-    fputs(log_severity_colors[level], stddbg);
-    fprintf(stddbg, "[%s] ", module);
-    vfprintf(stddbg, format, args);
-    fputs(color_reset, stddbg);
-    fputc('\n', stddbg);
+    if (log_mode == LOG_MODE_BINARY) {
+        log_binary(module, level, format, args);
+        va_end(args);
+        return;
+    }
 
+    log_text(module, level, format, args);
     va_end(args);
 }
 
+void log_set_console_level(DebugLevel level) {
+    console_level = level;
+}
+
+DebugLevel log_get_console_level() {
+    return console_level;
+}
+
+int log_render() {
+    int rendered = 0;
+    KmsgEntry entry;
+
+    for (;;) {
+        uint32_t head = __atomic_load_n(&kmsg_head, __ATOMIC_ACQUIRE);
+        if (kmsg_rendered == head) break;
+
+        if (head - kmsg_rendered > KMSG_RING_SIZE) {
+            fprintf(stddbg, "... %u kernel messages dropped ...\n",
+                head - KMSG_RING_SIZE - kmsg_rendered);
+            kmsg_rendered = head - KMSG_RING_SIZE;
+        }
+
+        if (!read_kmsg(kmsg_rendered, &entry)) {
+            // The writer that claimed this entry has not finished yet
+            if (__atomic_load_n(&kmsg_head, __ATOMIC_ACQUIRE) - kmsg_rendered 
+                <= KMSG_RING_SIZE
+            )
+                break;
+            continue;
+        }
+
+        fputs(log_severity_colors[entry.level], stddbg);
+        fprintf(stddbg, "[%s] %s", entry.module, entry.text);
+        fputs(color_reset, stddbg);
+        fputc('\n', stddbg);
+
+        if (entry.level >= console_level)
+            printf("[%s] %s\n", entry.module, entry.text);
+
+        kmsg_rendered++;
+        rendered++;
+    }
+
+    return rendered;
+}
+
+void log_dump(FILE *stream) {
+    KmsgEntry entry;
+    uint32_t head = __atomic_load_n(&kmsg_head, __ATOMIC_ACQUIRE);
+    uint32_t slot = head > KMSG_RING_SIZE ? head - KMSG_RING_SIZE : 0;
+
+    for (; slot != head; slot++) {
+        if (!read_kmsg(slot, &entry)) continue;
+
+        // The TSC starts at 0 on reset, so this is the time since boot
+        uint64_t us = cycles_to_ns(entry.timestamp) / 1000;
+        fprintf(stream, "[%5llu.%06llu] %s [%s] %s\n", 
+            us / 1000000, us % 1000000, log_level_names[entry.level],
+            entry.module, entry.text
+        );
+    }
+}
+
+void log_set_mode(LogMode mode) {
+    log_mode = mode;
+}
+
+/**
+ * Send [count] records to the host. They go to the virtio console's export
+ * port when there is one, otherwise they are mixed in with stddbg.
+*/
+static void emit_records(const LogRecord *records, int count) {
+    if (count == 0) return;
+
+    if (virtio_console_port_ready(VIRTIO_CONSOLE_PORT_EXPORT)) {
+        virtio_console_write(
+            VIRTIO_CONSOLE_PORT_EXPORT, records, count * sizeof(LogRecord)
+        );
+    } else {
+        fwrite(records, sizeof(LogRecord), count, stddbg);
+    }
+}
+
+int log_flush_binary() {
+    int written = 0;
+    uint32_t dropped = 0;
+    LogRecord batch[LOG_FLUSH_BATCH];
+    int batched = 0;
+
+    for (;;) {
+        uint32_t head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+        if (log_tail == head) break;
+
+        // Skip records that have already been overwritten
+        if (head - log_tail > LOG_RING_SIZE) {
+            dropped += head - LOG_RING_SIZE - log_tail;
+            log_tail = head - LOG_RING_SIZE;
+        }
+
+        LogRecord *slot = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+        uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+        // The writer that claimed this slot has not finished yet
+        if (sequence != log_tail + 1) break;
+
+        LogRecord *record = &batch[batched];
+        *record = *slot;
+
+        // The record was overwritten while it was being copied
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != sequence) {
+            dropped++;
+            log_tail++;
+            continue;
+        }
+
+        record->dropped = dropped > 0xFFFF ? 0xFFFF : dropped;
+        dropped = 0;
+        log_tail++;
+        written++;
+
+        if (++batched == LOG_FLUSH_BATCH) {
+            emit_records(batch, batched);
+            batched = 0;
+        }
+    }
+
+    emit_records(batch, batched);
+    return written;
+}
+
 void panic(const char *module, char *format, ...) {
     disable_interrupts();
+    log_flush_binary();
+    log_render();
     
     va_list args;
     va_start(args, format);
@@ -48,12 +369,14 @@ void panic(const char *module, char *format, ...) {
     fprintf(stderr, "KERNEL PANIC");
     fputs(color_reset, stddbg);
     fputc('\n', stddbg);
+    fflush(stddbg);
 
     fprintf(stderr, "Panicking:\n  ");
     fprintf(stderr, "[%s] ", module);
     vfprintf(stderr, format, args);
     fputc('\n', stderr);
     fprintf(stderr, "KERNEL PANIC");
+    fflush(stderr);
 
     va_end(args);
 
@@ -2,9 +2,26 @@
 
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #define MIN_LOG_LEVEL 0
 
+// Number of records kept by the binary log ring. Must be a power of 2.
+#define LOG_RING_SIZE 256
+
+// Maximum number of 32-bit argument words stored with a binary log record.
+#define LOG_RECORD_MAX_ARGS 9
+
+// Marks the start of each binary record in the stddbg output ("KLOG").
+#define LOG_RECORD_MAGIC 0x474F4C4B
+
+// Number of messages kept by the kernel message log. Must be a power of 2.
+#define KMSG_RING_SIZE 512
+
+// Maximum length of a kernel message log entry, including the terminator.
+#define KMSG_TEXT_SIZE 108
+
 typedef enum {
     LVL_DEBUG = 0,
     LVL_INFO = 1,
@@ -13,6 +30,28 @@ typedef enum {
     LVL_CRITICAL = 5
 } DebugLevel;
 
+typedef enum {
+    LOG_MODE_TEXT,      // Format and output each message at the call site
+    LOG_MODE_BINARY     // Store the raw arguments and decode on the host
+} LogMode;
+
+/**
+ * A log message as stored by the binary log. The format and module pointers
+ * point into the kernel image so the host decoder (scripts/decode_log.py)
+ * can look the strings up in kernel.elf and render the message later.
+*/
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;      // Ring slot + 1 once the record is complete
+    uint64_t timestamp;     // TSC value when the message was logged
+    const char *module;
+    const char *format;
+    uint8_t level;
+    uint8_t arg_words;      // Number of valid words in args
+    uint16_t dropped;       // Records lost to overwrites before this one
+    uint32_t args[LOG_RECORD_MAX_ARGS];
+} __attribute__((packed)) LogRecord;
+
 /**
  * Print a message and then hexdump of [count] bytes of the buffer pointed to 
  * by [buffer].
@@ -26,7 +65,8 @@ void debug_buffer(const char *msg, const void *buffer, size_t count);
 
 /**
  * Log a message with the prefix [module] at debug level [level] and controlled
- * by the format string [format].
+ * by the format string [format]. In text mode the message is formatted into
+ * the kernel message log and rendered later by log_render.
  * 
  * Parameters:
  *   module: The module previx to use
@@ -36,6 +76,59 @@ void debug_buffer(const char *msg, const void *buffer, size_t count);
 */
 void logf(const char *module, DebugLevel level, const char *format, ...);
 
+/**
+ * Choose how logf outputs messages. In binary mode logf only copies the
+ * format pointer, a timestamp and the raw arguments into a lock-free ring;
+ * log_flush_binary writes the records out later.
+ * 
+ * Parameters:
+ *   mode: The log mode to use
+*/
+void log_set_mode(LogMode mode);
+
+/**
+ * Only render messages at [level] or above to the console. Every message is
+ * still kept in the kernel message log and rendered to stddbg.
+ * 
+ * Parameters:
+ *   level: The lowest level shown on the console
+*/
+void log_set_console_level(DebugLevel level);
+
+/**
+ * Get the lowest level rendered to the console.
+*/
+DebugLevel log_get_console_level();
+
+/**
+ * Render the messages logged since the last call to stddbg and, if their
+ * level is high enough, to the console. logf only stores text messages in
+ * the kernel message log; this must be called from outside interrupt
+ * handlers for them to be seen.
+ * 
+ * Returns:
+ *   The number of messages rendered
+*/
+int log_render();
+
+/**
+ * Print every message still held by the kernel message log to [stream] with
+ * its timestamp and level.
+ * 
+ * Parameters:
+ *   stream: The stream to print to
+*/
+void log_dump(FILE *stream);
+
+/**
+ * Write all complete binary log records to stddbg. Records may be written
+ * into the ring from interrupt handlers while this runs.
+ * 
+ * Returns:
+ *   The number of records written
+*/
+int log_flush_binary();
+
 void panic(const char *module, char *format, ...);
 
 /**
@@ -1,5 +1,6 @@
 #include "disk.h"
 
+#include "debug.h"
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,7 +40,7 @@ static int partition_count;
 static void read_gpt(ATA_Drive *drive) {
     uint8_t *buffer = malloc(512);
     if (buffer == NULL) {
-        printf("  ERROR: Could not allocate memory for disk buffer\n");
+        log_error("Disk", "Could not allocate memory for disk buffer");
         return;
     }
 
@@ -48,14 +49,14 @@ static void read_gpt(ATA_Drive *drive) {
 
     // Read in the header
     if (!drive->read_sectors(1, 1, buffer)) {
-        printf("  ERROR: Disk read failed");
+        log_error("Disk", "Disk read failed");
         free(buffer);
         return;
     }
 
 
     if (*((uint64_t*)(header->signature)) != ELF_MAGIC) {
-        printf("  DISK ERROR: GPT Header Not Valid");
+        log_error("Disk", "GPT Header Not Valid");
         free(buffer);
         return;
     }
@@ -76,7 +77,7 @@ static void read_gpt(ATA_Drive *drive) {
         if (lba != target_lba) {
             lba = target_lba;
             if (!drive->read_sectors(1, lba, buffer)) {
-                printf("  ERROR: Disk read failed");
+                log_error("Disk", "Disk read failed");
                 free(buffer);
                 return;
             }
@@ -93,7 +94,7 @@ static void read_gpt(ATA_Drive *drive) {
         partition = malloc(sizeof(*partition));
         char *name = malloc(name_size);
         if (partition == NULL || name == NULL) {
-            printf("  ERROR: Could not allocate memory for partition");
+            log_error("Disk", "Could not allocate memory for partition");
             free(buffer);
             return;
         }
@@ -126,8 +127,7 @@ ListNode *disk_get_partitions() {
 }
 
 void disk_initialize() {
-    printf("\n");
-    printf("Initializing Disk\n");
+    log_info("Disk", "Initializing Disk");
 
     ATA_Drive *drive;
     for (int i=0; i<4; i++) {
@@ -136,27 +136,32 @@ void disk_initialize() {
     }
 
     if (drive == NULL) {
-        printf("  ERROR: No Disk Found");
+        log_error("Disk", "No Disk Found");
         return;
     }
 
     read_gpt(drive);
-    printf("  Found %d partition(s)\n", partition_count);
+    log_info("Disk", "Found %d partition(s)", partition_count);
     ListNode *current = partitions;
     int i=0;
     while (current) {
         Partition *part = current->value;
-        printf("  Partition %d:\n", i);
-        printf("  | Name: ");
-        for (int j=0; j<part->name_length; j++)
-            if (part->name[j] != '\0') putc(part->name[j], stdout);
-        printf("\n");
-        printf("  | LBA Start: %#llx\n", part->start);
-        printf("  | Size Sectors: %#llx\n", part->size);
-        printf("  | Size: %lld MB\n", part->size / 2 / 1024);
+
+        // The name is UTF-16, keep the low byte of each character
+        char name[37];
+        int name_length = 0;
+        for (int j=0; j<part->name_length && name_length < 36; j++)
+            if (part->name[j] != '\0') name[name_length++] = part->name[j];
+        name[name_length] = '\0';
+
+        log_info("Disk", "Partition %d:", i);
+        log_info("Disk", "| Name: %s", name);
+        log_info("Disk", "| LBA Start: %#llx", part->start);
+        log_info("Disk", "| Size Sectors: %#llx", part->size);
+        log_info("Disk", "| Size: %lld MB", part->size / 2 / 1024);
         current = current->next;
         i++;
     }
 
-    printf("Initialized Disk\n");
+    log_info("Disk", "Initialized Disk");
 }
\ No newline at end of file
@@ -1,42 +1,166 @@
 #include "events.h"
-#include <stdlib.h>
-#include <stddef.h>
 
-static Event *head;
-static Event *tail;
-static int event_count = 0;
+#include <arch/i686/io.h>
+#include <string.h>
 
-void add_event(Event_Handler handler, void* args) {
-    Event* new_event = malloc(sizeof(Event));
-    new_event->handler = handler;
-    new_event->next = NULL;
-    new_event->args = args;
+static const EventPriority source_priorities[EVENT_SOURCE_COUNT] = {
+    [EVENT_SOURCE_TIMER] = EVENT_PRIORITY_HIGH,
+    [EVENT_SOURCE_KEYBOARD] = EVENT_PRIORITY_NORMAL,
+};
 
-    // Add to head if there is no element
-    if (head == NULL)
-        head = new_event;
+static EventQueue queues[EVENT_SOURCE_COUNT];
 
-    // At to tail
-    if (tail != NULL)
-        tail->next = new_event;
+// Only touched by the dispatcher
+static EventClassStats class_stats[EVENT_PRIORITY_COUNT];
+static uint32_t class_skips[EVENT_PRIORITY_COUNT];
 
-    tail = new_event;
-    event_count++;
+bool add_event_with_deadline(
+    EventSource source, Event_Handler handler, const void *payload, size_t size,
+    uint64_t deadline
+) {
+    if (source >= EVENT_SOURCE_COUNT || size > EVENT_PAYLOAD_SIZE) return false;
+
+    EventQueue *queue = &queues[source];
+    uint32_t head = queue->head;
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail == EVENT_QUEUE_SIZE) {
+        queue->dropped++;
+        return false;
+    }
+
+    Event *event = &queue->events[head & (EVENT_QUEUE_SIZE - 1)];
+    event->handler = handler;
+    event->posted = read_tsc();
+    event->deadline = deadline;
+    memcpy(event->payload, payload, size);
+
+    if (head + 1 - tail > queue->max_depth) queue->max_depth = head + 1 - tail;
+
+    // Publish the event only after its contents are written
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool add_event(
+    EventSource source, Event_Handler handler, const void *payload, size_t size
+) {
+    return add_event_with_deadline(source, handler, payload, size, 0);
 }
 
-void call_next_event() {
-    if (head == NULL) return;
-
-    Event_Handler handler = head->handler;
-    void *args = head->args;
-    Event *next = head;
-    head = head->next;
-    event_count--;
-    free(next);
-    
-    handler(args);
+// Lower ranks are more urgent. The fields are compared in order.
+typedef struct {
+    int tier;                   // 0 overdue, 1 aged class, 2 everything else
+    int order;                  // Class order within the tier
+    uint64_t deadline;
+    uint64_t posted;
+} EventRank;
+
+/**
+ * Rank [event] from a source in class [priority] at TSC time [now]
+*/
+static EventRank rank_event(const Event *event, EventPriority priority, uint64_t now) {
+    EventRank rank;
+    rank.deadline = event->deadline != 0 ? event->deadline : UINT64_MAX;
+    rank.posted = event->posted;
+
+    if (event->deadline != 0 && event->deadline <= now) {
+        rank.tier = 0;
+        rank.order = 0;
+    } else if (class_skips[priority] >= EVENT_AGING_LIMIT) {
+        rank.tier = 1;
+        rank.order = -(int)class_skips[priority];
+    } else {
+        rank.tier = 2;
+        rank.order = priority;
+    }
+    return rank;
+}
+
+static bool rank_before(const EventRank *a, const EventRank *b) {
+    if (a->tier != b->tier) return a->tier < b->tier;
+    if (a->order != b->order) return a->order < b->order;
+    if (a->deadline != b->deadline) return a->deadline < b->deadline;
+    return a->posted < b->posted;
+}
+
+bool call_next_event() {
+    uint64_t now = read_tsc();
+    int best = -1;
+    EventRank best_rank;
+    bool waiting[EVENT_PRIORITY_COUNT] = { false };
+
+    for (int i = 0; i < EVENT_SOURCE_COUNT; i++) {
+        EventQueue *queue = &queues[i];
+        uint32_t tail = queue->tail;
+        if (tail == __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) continue;
+
+        EventPriority priority = source_priorities[i];
+        waiting[priority] = true;
+
+        const Event *event = &queue->events[tail & (EVENT_QUEUE_SIZE - 1)];
+        EventRank rank = rank_event(event, priority, now);
+        if (best < 0 || rank_before(&rank, &best_rank)) {
+            best = i;
+            best_rank = rank;
+        }
+    }
+
+    if (best < 0) return false;
+
+    EventQueue *queue = &queues[best];
+    EventPriority priority = source_priorities[best];
+    uint32_t tail = queue->tail;
+
+    // Copy the event out so the slot can be reused while it is handled
+    Event event = queue->events[tail & (EVENT_QUEUE_SIZE - 1)];
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+    // Every other class that had to wait gets closer to being aged
+    for (int i = 0; i < EVENT_PRIORITY_COUNT; i++) {
+        if (waiting[i] && i != priority) class_skips[i]++;
+    }
+    class_skips[priority] = 0;
+
+    // The event may have been posted after the scan read the TSC, or on a
+    // CPU whose TSC is slightly ahead
+    EventClassStats *stats = &class_stats[priority];
+    now = read_tsc();
+    uint64_t latency = now > event.posted ? now - event.posted : 0;
+    stats->dispatched++;
+    stats->total_latency += latency;
+    if (latency > stats->max_latency) stats->max_latency = latency;
+    if (event.deadline != 0 && now > event.deadline) stats->missed_deadlines++;
+    if (best_rank.tier == 1) stats->aged++;
+
+    event.handler(event.payload);
+    return true;
 }
 
 int get_event_count() {
-    return event_count;
-}
\ No newline at end of file
+    int count = 0;
+    for (int i = 0; i < EVENT_SOURCE_COUNT; i++) {
+        count += __atomic_load_n(&queues[i].head, __ATOMIC_ACQUIRE) - 
+            queues[i].tail;
+    }
+    return count;
+}
+
+void event_get_stats(EventPriority priority, EventClassStats *stats) {
+    *stats = class_stats[priority];
+    stats->depth = 0;
+    stats->max_depth = 0;
+    stats->dropped = 0;
+
+    // The producer side counters live with each source's queue
+    for (int i = 0; i < EVENT_SOURCE_COUNT; i++) {
+        if (source_priorities[i] != priority) continue;
+
+        EventQueue *queue = &queues[i];
+        stats->depth += __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) - 
+            queue->tail;
+        stats->dropped += queue->dropped;
+        if (queue->max_depth > stats->max_depth)
+            stats->max_depth = queue->max_depth;
+    }
+}
@@ -1,13 +1,133 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of events each source can have waiting. Must be a power of 2.
+#define EVENT_QUEUE_SIZE 64
+
+// Largest payload that can be stored inline with an event
+#define EVENT_PAYLOAD_SIZE 28
+
+// A class with events waiting is dispatched once it has been passed over for
+// higher priority classes this many times in a row
+#define EVENT_AGING_LIMIT 8
+
+#define CACHE_LINE_SIZE 64
+
 typedef void (*Event_Handler)(void *);
 
-typedef struct Event{
+/**
+ * The sources events can come from. Each source has its own queue with a
+ * single producer, so a source must only post events from one context.
+*/
+typedef enum {
+    EVENT_SOURCE_TIMER,         // Expired timers, posted from IRQ 0
+    EVENT_SOURCE_KEYBOARD,
+    EVENT_SOURCE_COUNT
+} EventSource;
+
+/**
+ * Priority classes, from the most to the least urgent. Every source belongs
+ * to one class.
+*/
+typedef enum {
+    EVENT_PRIORITY_HIGH,
+    EVENT_PRIORITY_NORMAL,
+    EVENT_PRIORITY_LOW,
+    EVENT_PRIORITY_COUNT
+} EventPriority;
+
+typedef struct {
     Event_Handler handler;
-    void *args;
-    struct Event *next;
+    uint64_t posted;            // TSC value when the event was queued
+    uint64_t deadline;          // TSC value to dispatch it by, 0 if none
+    uint8_t payload[EVENT_PAYLOAD_SIZE];
 } Event;
 
-void add_event(Event_Handler handler, void *args);
-void call_next_event();
-int get_event_count();
\ No newline at end of file
+/**
+ * A single-producer single-consumer ring of events. The producer only writes
+ * head and the consumer only writes tail, and they are kept on separate cache
+ * lines.
+*/
+typedef struct {
+    volatile uint32_t head __attribute__((aligned(CACHE_LINE_SIZE)));
+    uint32_t dropped;           // Events lost because the queue was full
+    uint32_t max_depth;         // Most events that have been waiting at once
+    volatile uint32_t tail __attribute__((aligned(CACHE_LINE_SIZE)));
+    Event events[EVENT_QUEUE_SIZE] __attribute__((aligned(CACHE_LINE_SIZE)));
+} EventQueue;
+
+typedef struct {
+    uint32_t depth;             // Events waiting now
+    uint32_t max_depth;         // Highest depth of any one source
+    uint32_t dispatched;
+    uint32_t dropped;
+    uint32_t aged;              // Dispatches forced by aging
+    uint32_t missed_deadlines;  // Events dispatched after their deadline
+    uint64_t total_latency;     // TSC cycles from posting to dispatch
+    uint64_t max_latency;
+} EventClassStats;
+
+/**
+ * Queue an event from [source] that will call [handler] with a copy of
+ * [payload]. Does not allocate or block so it can be used from interrupt
+ * handlers.
+ * 
+ * Parameters:
+ *   source: The source posting the event
+ *   handler: The function to call with the payload
+ *   payload: The data to pass to the handler
+ *   size: The size of the payload, at most EVENT_PAYLOAD_SIZE
+ * 
+ * Returns:
+ *   Whether the event was queued. It is dropped if the queue is full.
+*/
+bool add_event(
+    EventSource source, Event_Handler handler, const void *payload, size_t size
+);
+
+/**
+ * Queue an event like add_event that should be dispatched before the TSC
+ * reaches [deadline]. Events past their deadline are dispatched before
+ * any others, and within a class earlier deadlines go first.
+ * 
+ * Parameters:
+ *   source: The source posting the event
+ *   handler: The function to call with the payload
+ *   payload: The data to pass to the handler
+ *   size: The size of the payload, at most EVENT_PAYLOAD_SIZE
+ *   deadline: The TSC value the event should be dispatched by
+ * 
+ * Returns:
+ *   Whether the event was queued
+*/
+bool add_event_with_deadline(
+    EventSource source, Event_Handler handler, const void *payload, size_t size,
+    uint64_t deadline
+);
+
+/**
+ * Dispatch the most urgent waiting event. Overdue events go first. Next is
+ * any class that has been passed over EVENT_AGING_LIMIT times, and then the
+ * highest priority class. Within a class the earliest deadline and then the
+ * oldest event is chosen. The payload passed to the handler is only valid
+ * during the call.
+ * 
+ * Returns:
+ *   Whether an event was handled
+*/
+bool call_next_event();
+
+int get_event_count();
+
+/**
+ * Get the queue depth, dispatch latency and other counters of a priority
+ * class.
+ * 
+ * Parameters:
+ *   priority: The class to get the counters of
+ *   stats: Where to store the counters
+*/
+void event_get_stats(EventPriority priority, EventClassStats *stats);
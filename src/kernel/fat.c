@@ -1,5 +1,6 @@
 #include "fat.h"
 
+#include "debug.h"
 #include "disk.h"
 #include <stdlib.h>
 #include <stdio.h>
@@ -152,7 +153,7 @@ static uint32_t next_cluster(uint32_t current_cluster) {
 
     if (fat_sector != target_fat_sector) {
         if (!disk_read_sectors(partition, 1, target_fat_sector, fat_buffer)) {
-            printf("DISK READ ERROR: Could not read fat sector");
+            log_error("FAT", "Could not read fat sector");
             fat_sector = 0; // Invalid sector, will be reloaded on next read
             return 0x0FFFFFF7;
         }
@@ -203,7 +204,7 @@ static int load_file_buffer(FileData *fd) {
 static void fat_init_partition(Partition *part) {
     // Read the boot record
     if (!disk_read_sectors(part, 1, 0, fat_buffer)) {
-        printf("  ERROR: Disk read failed.");
+        log_error("FAT", "Disk read failed.");
         return;
     }
 
@@ -211,7 +212,7 @@ static void fat_init_partition(Partition *part) {
 
     // Parse teh exfat later
     if (boot_record.bytes_per_sector == 0) {
-        printf("  EXFAT Detected. Not supported yet.\n");
+        log_warn("FAT", "EXFAT Detected. Not supported yet.");
         return;
     }
 
@@ -251,7 +252,7 @@ static void fat_init_partition(Partition *part) {
         boot_record.ebr_32.signature == 0x29;
     
     if (!br_ok) {
-        printf("  Boot Record Invalid\n");
+        log_error("FAT", "Boot Record Invalid");
         return;
     }
 
@@ -263,11 +264,11 @@ static void fat_init_partition(Partition *part) {
         else format = FAT_16;
     }
 
-    printf("  Format: %s\n", 
+    log_info("FAT", "Format: %s", 
         (const char *[]){"FAT 12", "FAT 16", "FAT 32"}[format]);
-    printf("  Total Sectors: %#x\n", total_sectors);
-    printf("  Total Clusters: %#x\n", total_clusters);
-    printf("  Fat Size: %#x\n", fat_size);
+    log_info("FAT", "Total Sectors: %#x", total_sectors);
+    log_info("FAT", "Total Clusters: %#x", total_clusters);
+    log_info("FAT", "Fat Size: %#x", fat_size);
 
     partition = part;
 }
@@ -487,8 +488,7 @@ int fat_open_file(
 }
 
 void fat_initialize() {
-    printf("\n");
-    printf("Initializing FAT\n");
+    log_info("FAT", "Initializing FAT");
 
     ListNode *partition_node = disk_get_partitions();
     while (partition_node != NULL && partition == NULL) {
@@ -497,9 +497,9 @@ void fat_initialize() {
     }
 
     if (partition == NULL) {
-        printf("  No Valid Partition Found\n");
+        log_warn("FAT", "No Valid Partition Found");
         return;
     }
 
-    printf("Initialized FAT\n");
+    log_info("FAT", "Initialized FAT");
 }
\ No newline at end of file
@@ -5,15 +5,44 @@
 #include <arch/i686/irq.h>
 #include <arch/i686/isr.h>
 #include <arch/i686/acpi.h>
+#include <arch/i686/fpu.h>
+#include <arch/i686/ide.h>
 #include <arch/i686/ps2.h>
 #include <arch/i686/pci.h>
+#include <arch/i686/smp.h>
+#include <arch/i686/uart.h>
+#include <arch/i686/virtio_console.h>
+#include <arch/i686/io.h>
+#include <clock.h>
+#include <thread.h>
+#include <timer.h>
 
 void hal_initialize(BootData *boot_data) {
     gdt_initialize();
+    smp_initialize();
     idt_initialize();
     isr_initialize();
-    irq_initialize();
+
+    // The MADT is needed to find the I/O APIC, and the FADT to find the PM
+    // timer to calibrate the TSC against
     acpi_initialize();
+    clock_initialize();
+    irq_initialize();
+
+    // The drivers below use the timer for their timeouts
+    timer_initialize(TIMER_HZ);
+    fpu_initialize();
+    thread_initialize();
+    enable_interrupts();
+
+    uart_initialize();
     ps2_initialize();
+
+    // Started before PCI so the application processors can run the driver
+    // probes that are allowed to go in parallel
+    smp_start_aps();
+
+    pci_register_driver(ide_get_pci_driver());
+    pci_register_driver(virtio_console_get_pci_driver());
     pci_initialize(boot_data->pci_v2_installed, boot_data->pci_characteristics);
 }
\ No newline at end of file
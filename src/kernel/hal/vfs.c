@@ -2,27 +2,60 @@
 
 #include "file.h"
 #include <arch/i686/e9.h>
+#include <arch/i686/uart.h>
 #include <arch/i686/vga_text.h>
+#include <arch/i686/virtio_console.h>
 
 #define DEBUG_MODE 1
 
+// Send stddbg to COM1 instead of port 0xE9 when a serial port is present
+#define STDDBG_SERIAL 1
+
+// Also copy stdout to COM1 in debug mode instead of port 0xE9
+// #define STDOUT_SERIAL 1
+
+/**
+ * Write [size] bytes from [data] to the host debug channel. This is the
+ * virtio console if there is one, then COM1 if it is present and [serial] is
+ * set, otherwise port 0xE9.
+*/
+static void debug_write(const uint8_t *data, size_t size, bool serial) {
+    if (virtio_console_port_ready(VIRTIO_CONSOLE_PORT_LOG)) {
+        virtio_console_write(VIRTIO_CONSOLE_PORT_LOG, data, size);
+        return;
+    }
+
+    if (serial && uart_present()) {
+        uart_write((const char *)data, size);
+        return;
+    }
+
+    for (size_t i=0; i<size; i++) {
+        e9_putc(data[i]);
+    }
+}
+
 int vfs_write(FILE *file, const uint8_t *data, size_t size) {
     switch (file->handle) {
     case STREAM_STDIN:
         return 0;
     case STREAM_STDOUT:
     case STREAM_STDERR:
-        for (size_t i=0; i<size; i++) {
-            vga_putc(data[i]);
+        vga_write((const char *)data, size);
 #ifdef DEBUG_MODE
-            e9_putc(data[i]);
+#ifdef STDOUT_SERIAL
+        debug_write(data, size, true);
+#else
+        debug_write(data, size, false);
+#endif
 #endif
-        }
         return size;
     case STREAM_STDDBG:
-        for (size_t i=0; i<size; i++) {
-            e9_putc(data[i]);
-        }
+#ifdef STDDBG_SERIAL
+        debug_write(data, size, true);
+#else
+        debug_write(data, size, false);
+#endif
         return size;
     default:
         if (file->accessors == NULL) return 0;
@@ -31,6 +64,25 @@ int vfs_write(FILE *file, const uint8_t *data, size_t size) {
     }
 }
 
+int vfs_flush(FILE *file) {
+    switch (file->handle) {
+    case STREAM_STDOUT:
+    case STREAM_STDERR:
+        vga_flush();
+        return 0;
+    case STREAM_STDDBG:
+        virtio_console_flush(VIRTIO_CONSOLE_PORT_LOG);
+        uart_flush();
+        return 0;
+    case STREAM_STDIN:
+        return 0;
+    default:
+        if (file->accessors == NULL) return 0;
+        if (file->accessors->flush == NULL) return 0;
+        return file->accessors->flush(file);
+    }
+}
+
 int vfs_read(FILE *file, char *buff, size_t size) {
     switch (file->handle) {
     case STREAM_STDIN:
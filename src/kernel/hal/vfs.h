@@ -24,4 +24,16 @@ enum StandardStreams {
 */
 int vfs_write(FILE *file, const uint8_t *data, size_t size);
 
+/**
+ * Write out any data buffered for [file]. For stdout and stderr this copies
+ * the console shadow buffer to the screen.
+ * 
+ * Parameters:
+ *   file: The file to flush
+ * 
+ * Returns:
+ *   int: 0 on success
+*/
+int vfs_flush(FILE *file);
+
 int vfs_read(FILE *file, char *buff, size_t size);
\ No newline at end of file
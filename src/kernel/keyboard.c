@@ -1,6 +1,7 @@
 #include "keyboard.h"
 
 #include <arch/i686/ps2.h>
+#include "debug.h"
 #include "events.h"
 #include <stdbool.h>
 #include <stdio.h>
@@ -456,19 +457,21 @@ static void on_key_pressed(uint8_t scancode) {
         scancode_byte_count = 0;
 
         if (keypress_handler != NULL) {
-            KeypressEvent *event = malloc(sizeof(KeypressEvent));
-            event->ascii = keycode_to_ascii(keycode);
-            event->code = keycode;
-            event->released = released;
-            event->modifiers.shift = modifiers.shift;
-            event->modifiers.alt = modifiers.alt;
-            event->modifiers.control = modifiers.control;
-            event->modifiers.function = modifiers.function;
-            event->modifiers.gui = modifiers.gui;
-            event->toggles.caps_lock = toggles.caps_lock;
-            event->toggles.num_lock = toggles.num_lock;
-            event->toggles.scroll_lock = toggles.scroll_lock;
-            add_event(keypress_handler, event);
+            KeypressEvent event;
+            event.ascii = keycode_to_ascii(keycode);
+            event.code = keycode;
+            event.released = released;
+            event.modifiers.shift = modifiers.shift;
+            event.modifiers.alt = modifiers.alt;
+            event.modifiers.control = modifiers.control;
+            event.modifiers.function = modifiers.function;
+            event.modifiers.gui = modifiers.gui;
+            event.toggles.caps_lock = toggles.caps_lock;
+            event.toggles.num_lock = toggles.num_lock;
+            event.toggles.scroll_lock = toggles.scroll_lock;
+            add_event(
+                EVENT_SOURCE_KEYBOARD, keypress_handler, &event, sizeof(event)
+            );
         }
     }
 }
@@ -578,7 +581,7 @@ static void on_keyboard_send_byte(uint8_t byte) {
 
 static void continue_init(bool success, uint8_t response) {
     if (!success) {
-        printf("[KBD] ERROR Initialize Command Not Acknowledged");
+        log_error("Keyboard", "Initialize Command Not Acknowledged");
         initialized = true;
         return;
     }
@@ -599,11 +602,11 @@ static void continue_init(bool success, uint8_t response) {
         return;
     case GET_SCAN_SET:
         if (response != 2) {
-            printf("  Error: Scancode Set 2 Not Supported\n");
+            log_error("Keyboard", "Scancode Set 2 Not Supported");
             initialized = true;
             return;
         }
-        printf("  Using Scancode Set: %d\n", response);
+        log_info("Keyboard", "Using Scancode Set: %d", response);
         scan_code_set = response;
         init_state = ENABLE_SCAN;
         add_command(CMD_ENABLE_SCAN, false, 0, false, continue_init);
@@ -635,17 +638,17 @@ static bool is_keyboard(PS2_Device *device) {
 }
 
 void kbd_initialize() {
-    printf("Initializing Keyboard\n");
+    log_info("Keyboard", "Initializing Keyboard");
     device = ps2_get_port_1_device();
     if (!is_keyboard(device)) {
         device = ps2_get_port_2_device();
         if (!is_keyboard(device)) {
             device = NULL;
-            printf("  No Keyboard Found\n");
+            log_warn("Keyboard", "No Keyboard Found");
             return;
         }
     }
-    printf("  Found Keyboard Device\n");
+    log_info("Keyboard", "Found Keyboard Device");
     device->on_byte_recieved = on_keyboard_send_byte;
 
     initialized = false;
@@ -663,7 +666,7 @@ void kbd_initialize() {
 
     while(!initialized);
 
-    printf("Initialized Keyboard\n");
+    log_info("Keyboard", "Initialized Keyboard");
 }
 
 void register_handler(Event_Handler handler) {
@@ -27,12 +27,12 @@ enum PrintFormatFlags {
     FLAG_GROUP = 32
 };
 
-char* hexchars = "0123456789ABCDEF";
+static const char hexchars[] = "0123456789ABCDEF";
 
 /**
  * Print out [num] in base [radix] signed according to [sign] and accounting
  * for width, precision, and flags according to the fprintf specfication.
- * [printc] with stream argument [stream] is used to print the characters.
+ * [printc] with context argument [context] is used to print the characters.
  * 
  * Parameters:
  *   num: The number to print
@@ -41,15 +41,15 @@ char* hexchars = "0123456789ABCDEF";
  *   precision: The minimum number of digits to print
  *   sign: Whether or not the number is signed
  *   flags: Flags used to change how printing is done
- *   stream: The stream to pass to [printc]
+ *   context: The context to pass to [printc]
  *   printc: The function to use for printing characters
  * 
  * Returns:
  *   The number of characters printed
 */
-int print_num(
+static int print_num(
     long long num, int radix, int width, int precision, bool sign, int flags,
-    FILE * restrict stream, char_printer printc
+    void *context, char_printer printc
 ) {
     char buffer[64];
     int pos = 0;
@@ -92,26 +92,26 @@ int print_num(
     if (!leftJustify && padding > 0) {
         if (padZeros) {
             if (hasSign) {
-                printc(signChar, stream);
+                printc(signChar, context);
                 char_count++;
                 padding--;
             }
 
             if (altForm) {
                 if (radix == 8 && num == 0) {
-                    printc('0', stream);
+                    printc('0', context);
                     char_count++;
                     padding--;
                 } else if (radix == 16) {
-                    printc('0', stream);
-                    printc('x', stream);
+                    printc('0', context);
+                    printc('x', context);
                     char_count += 2;
                     padding -= 2;
                 }
             }
 
             while (padding > 0) {
-                printc(padChar, stream);
+                printc(padChar, context);
                 char_count++;
                 padding--;
             }
@@ -120,42 +120,42 @@ int print_num(
             if (altForm) padding -= 2;
 
             while (padding > 0) {
-                printc(padChar, stream);
+                printc(padChar, context);
                 char_count++;
                 padding--;
             }
 
             if (hasSign) {
-                printc(signChar, stream);
+                printc(signChar, context);
                 char_count++;
             }
 
             if (altForm) {
                 if (radix == 8 && num == 0) {
-                    printc('0', stream);
+                    printc('0', context);
                     char_count++;
                 } else if (radix == 16) {
-                    printc('0', stream);
-                    printc('x', stream);
+                    printc('0', context);
+                    printc('x', context);
                     char_count += 2;
                 }
             }
         }
     } else  {
         if (hasSign) {
-            printc(signChar, stream);
+            printc(signChar, context);
             char_count++;
             padding--;
         }
 
         if (flags & FLAG_ALT_FORM) {
             if (radix == 8 && num == 0) {
-                printc('0', stream);
+                printc('0', context);
                 char_count++;
                 padding--;
             } else if (radix == 16) {
-                printc('0', stream);
-                printc('x', stream);
+                printc('0', context);
+                printc('x', context);
                 char_count += 2;
                 padding -= 2;
             }
@@ -165,7 +165,7 @@ int print_num(
 
     // Output extra zeros for precision
     while (precision > pos) {
-        printc('0', stream);
+        printc('0', context);
         char_count++;
         precision--;
     }
@@ -173,7 +173,7 @@ int print_num(
     // Output the number
     if (precision != 0 || num != 0) {
         while (--pos >= 0) {
-            printc(buffer[pos], stream);
+            printc(buffer[pos], context);
             char_count++;
         }
     }
@@ -181,7 +181,7 @@ int print_num(
 
     // Output any ending padding
     while (padding > 0) {
-        printc(padChar, stream);
+        printc(padChar, context);
         char_count++;
         padding--;
     }
@@ -209,7 +209,7 @@ static int parseint(const char** str) {
 }
 
 int format_print(
-    const char *fmt, FILE * restrict stream, char_printer printc, va_list arg
+    const char *fmt, void *context, char_printer printc, va_list arg
 ) {
     enum PrintFormatState state = STATE_NORMAL;
     enum PrintFormatLength length = LENGTH_NORMAL;
@@ -232,7 +232,7 @@ int format_print(
                 state = STATE_FLAGS;
                 break;
             default:
-                printc(*fmt, stream);
+                printc(*fmt, context);
                 char_count++;
                 break;
             }
@@ -302,19 +302,19 @@ int format_print(
         case STATE_SPECIFIER:
             switch (*fmt) {
             case 'c':
-                printc(va_arg(arg, int), stream);
+                printc(va_arg(arg, int), context);
                 char_count++;
                 break;
             case 's':
                 const char *s = va_arg(arg, const char*);
                 while (*s) {
-                    printc(*s, stream);
+                    printc(*s, context);
                     *s++;
                     char_count++;
                 }
                 break;
             case '%':
-                printc('%', stream);
+                printc('%', context);
                 char_count++;
                 break;
             case 'd':
@@ -351,19 +351,19 @@ int format_print(
                 case LENGTH_NORMAL:
                     char_count += print_num(
                         va_arg(arg, int), radix, width, precision, 
-                        has_sign, flags, stream, printc
+                        has_sign, flags, context, printc
                     );
                     break;
                 case LENGTH_LONG:
                     char_count += print_num(
                         va_arg(arg, long), radix, width, precision, 
-                        has_sign, flags, stream, printc
+                        has_sign, flags, context, printc
                     );
                     break;
                 case LENGTH_LONG_LONG:
                     char_count += print_num(
                         va_arg(arg, long long), radix, width, precision, 
-                        has_sign, flags, stream, printc
+                        has_sign, flags, context, printc
                     );
                     break;
                 }
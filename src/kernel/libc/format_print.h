@@ -4,9 +4,26 @@
 #include <stdbool.h>
 #include "stdio.h"
 
-typedef int (*char_printer)(int, FILE * restrict);
+/**
+ * Output a single character. [context] is the per-call state that was passed
+ * to format_print (a stream, an array cursor, ...).
+*/
+typedef int (*char_printer)(int c, void *context);
 
+/**
+ * Print [fmt] with [arg] using [printc] to output each character. All output
+ * state is kept in [context] and on the stack so this is safe to call from
+ * interrupt handlers while another print is in progress.
+ * 
+ * Parameters:
+ *   fmt: The format string
+ *   context: The state passed to every call to [printc]
+ *   printc: The function used to output characters
+ *   arg: The arguments for the format string
+ * 
+ * Returns:
+ *   The number of characters printed
+*/
 int format_print(
-    const char *fmt, FILE * restrict stream, 
-    char_printer printc, va_list arg
+    const char *fmt, void *context, char_printer printc, va_list arg
 );
\ No newline at end of file
@@ -1,15 +1,21 @@
 #include "memory.h"
 
+#include <arch/i686/spinlock.h>
 #include "defs.h"
 #include "debug.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 // #define DEBUG_MEMORY 0
 
 static const size_t malloc_align_size = 8;
 
+// Protects the free list from other CPUs
+static Spinlock heap_lock = SPINLOCK_INIT;
+
 extern char __start;
 extern char __end;
 
@@ -28,7 +34,7 @@ typedef struct MemoryNode {
 typedef struct {
     size_t total_size;
     size_t requested_size;
-    char offset;
+    uint16_t offset;
 } AllocatedRegionHeader;
 
 enum MemoryRegionType {
@@ -102,11 +108,11 @@ static void free_memory(pointer_t base, long long int length)
 static void print_memory_regions(MemoryRegion* memory_regions, int region_count) 
 {
 
-    printf("Memory Regions: \n");
-    printf("|             BASE |              END |           LENGTH |     TYPE |\n");
+    log_info("Memory", "Memory Regions:");
+    log_info("Memory", "|             BASE |              END |           LENGTH |     TYPE |");
     for (int i=0; i<region_count; i++) {
-        printf(
-            "| %16llx | %16llx | %16llx | %8lx |\n", 
+        log_info("Memory",
+            "| %16llx | %16llx | %16llx | %8lx |", 
             memory_regions[i].BaseAddress, 
             memory_regions[i].BaseAddress + memory_regions[i].Length, 
             memory_regions[i].Length, 
@@ -230,14 +236,18 @@ static long long int free_availiable_regions(
     pointer_t kernel_start = (pointer_t)&__start;
     pointer_t kernel_end = (pointer_t)&__end;
 
-    //! Should maybe be changed to a for loop to search for first availiable 
-    //! region
-    // Ensure first region does not start before first availiable memory
-    if (memory_regions[0].BaseAddress < first_aviliable_memory) {
-        memory_regions[0].Length = memory_regions[0].BaseAddress + 
-                                   memory_regions[0].Length - 
-                                   first_aviliable_memory;
-        memory_regions[0].BaseAddress = first_aviliable_memory;
+    if (first_aviliable_memory < LOW_MEMORY_RESERVED)
+        first_aviliable_memory = LOW_MEMORY_RESERVED;
+
+    // Ensure no region starts before first availiable memory
+    for (int i = 0; i < memory_region_count; i++) {
+        MemoryRegion *region = &memory_regions[i];
+        if (region->BaseAddress >= first_aviliable_memory) break;
+
+        uint64_t end = region->BaseAddress + region->Length;
+        region->Length = end > first_aviliable_memory ? 
+            end - first_aviliable_memory : 0;
+        region->BaseAddress = first_aviliable_memory;
     }
 
     long long int availiable_bytes = 0;
@@ -289,12 +299,16 @@ long long int memory_initialize(BootData* boot_data)
         boot_data->FirstAvailiableMemory
     );
 
-    log_info("Memory", "Availiable Memory: %#llx\n", availiable_bytes);
-    printf("Availiable Memory: %#llx\n", availiable_bytes);
+    log_info("Memory", "Availiable Memory: %#llx", availiable_bytes);
     return availiable_bytes;
 }
 
-void* aligned_alloc(size_t alignment, size_t size) 
+/**
+ * Allocate memory like aligned_alloc. The caller must hold heap_lock with
+ * interrupts disabled so threads, interrupt handlers and other CPUs can not
+ * change the free list.
+*/
+static void* allocate(size_t alignment, size_t size) 
 {
     if (size == 0) return NULL;
 
@@ -302,7 +316,7 @@ void* aligned_alloc(size_t alignment, size_t size)
     MemoryNode* best_fit = NULL;
     MemoryNode* previous = NULL;
     MemoryNode* current = start;
-    char alignment_offset = 0;
+    size_t alignment_offset = 0;
 
     while (current != NULL) {
         // If the best_fit is clearly better than the current node then skip
@@ -314,10 +328,9 @@ void* aligned_alloc(size_t alignment, size_t size)
         }
         
         // Determine size required for header and alignment
-        int offset = sizeof(AllocatedRegionHeader);
-        int align_offset = 
-            alignment - ((pointer_t)current + offset) % alignment;
-        offset += (alignment - align_offset) % alignment;
+        size_t offset = sizeof(AllocatedRegionHeader);
+        size_t misalignment = ((pointer_t)current + offset) % alignment;
+        offset += (alignment - misalignment) % alignment;
 
         // If the size is large enough then it becomes the new best fit
         if (size + offset <= current->size) {
@@ -359,14 +372,26 @@ void* aligned_alloc(size_t alignment, size_t size)
     header->requested_size = size;
     header->offset = alignment_offset;
 
+    // The offset back to the header is stored just before the object. It
+    // never overlaps the header's fields since they end before its padding.
     pointer_t allocated_start = (pointer_t)header + alignment_offset;
-    *((char*)(allocated_start-1)) = alignment_offset;
+    *((uint16_t*)(allocated_start-2)) = alignment_offset;
 
     return (void*)(allocated_start);
 }
 
+void* aligned_alloc(size_t alignment, size_t size) 
+{
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = allocate(alignment, size);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return ptr;
+}
+
 void* calloc(size_t n_memb, size_t size) {
-    return aligned_alloc(malloc_align_size, size * n_memb);
+    void* ptr = aligned_alloc(malloc_align_size, size * n_memb);
+    if (ptr != NULL) memset(ptr, 0, size * n_memb);
+    return ptr;
 }
 
 void* malloc(size_t size) {
@@ -375,17 +400,19 @@ void* malloc(size_t size) {
 
 void free(void* ptr) {
     pointer_t start = (pointer_t)ptr;
-    char align_offset = *(char*)(start-1);
+    uint16_t align_offset = *(uint16_t*)(start-2);
 
     AllocatedRegionHeader* header = 
         (AllocatedRegionHeader*)(start-align_offset);
 
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
     free_memory((pointer_t)header, header->total_size);
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
 void* realloc(void* ptr, size_t size) {
     pointer_t start = (pointer_t)ptr;
-    char align_offset = *(char*)(start-1);
+    uint16_t align_offset = *(uint16_t*)(start-2);
 
     AllocatedRegionHeader* header = 
         (AllocatedRegionHeader*)(start-align_offset);
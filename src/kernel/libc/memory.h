@@ -3,6 +3,10 @@
 #include "bootdata.h"
 #include <stddef.h>
 
+// Memory below this address is never allocated. It holds the real mode IVT,
+// the BIOS data area and the page application processors start in.
+#define LOW_MEMORY_RESERVED 0x10000
+
 /**
  * initialize the memory manager.
  * 
@@ -6,13 +6,32 @@
 #include <stdbool.h>
 #include <hal/vfs.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fat.h>
 
-static size_t array_max;
-static size_t array_index;
-static bool limit_array_size;
-static char * restrict array_out;
+// Characters gathered by a formatted print before they are written out
+#define STREAM_PRINT_BUFFER_SIZE 64
 
+/**
+ * Output state for printing into an array. One lives on the stack of each
+ * vsnprintf/vsprintf call so concurrent prints do not share anything.
+*/
+typedef struct {
+    char *out;
+    size_t index;
+    size_t max;
+    bool limit_size;
+} ArrayPrintContext;
+
+/**
+ * Output state for printing to a stream. Characters are gathered on the
+ * stack and written in batches so the device sees whole runs of text.
+*/
+typedef struct {
+    FILE *stream;
+    size_t count;
+    char buffer[STREAM_PRINT_BUFFER_SIZE];
+} StreamPrintContext;
 
 static FILE stdin_file = { .handle = STREAM_STDIN };
 static FILE stdout_file = { .handle = STREAM_STDOUT };
@@ -59,15 +78,16 @@ int fclose(FILE *stream) {
 int fflush(FILE *stream) {
     if (stream == NULL) {
         for (int i=0; i<FOPEN_MAX; i++) {
-            if (stream->opened) {
-                fflush(stream);
+            if (files[i].opened) {
+                fflush(files + i);
             }
         }
+        fflush(stdout);
+        fflush(stderr);
         return 0;
     }
 
-    if (stream->accessors != NULL && stream->accessors->flush != NULL)
-        stream->accessors->flush(stream);
+    vfs_flush(stream);
     return 0;
 }
 
@@ -123,24 +143,48 @@ int setvbuf(FILE * restrict stream, char * restrict buf, int mode, size_t size)
 }
 
 /**
- * Output a char to an array. Only output the char if limit_array_size is
- * false or there is space in the array.
+ * Output a char to an array. Only output the char if the size is not limited
+ * or there is space in the array for it and the null character.
  * 
  * Parameters:
  *   c: The character to print
- *   stream: A stream parameter so this function matches the printchar
- *           definition
+ *   context: The ArrayPrintContext of the array being printed to
 */
-static int print_char_to_array(int c, FILE * restrict stream) {
-    if (!limit_array_size || (array_index < array_max - 1)) {
-        array_out[array_index] = c;
-        array_index++;
+static int print_char_to_array(int c, void *context) {
+    ArrayPrintContext *array = context;
+    if (!array->limit_size || (array->index + 1 < array->max)) {
+        array->out[array->index] = c;
+        array->index++;
         return 1;
     }
 
     return 0;
 }
 
+/**
+ * Write the characters gathered in a StreamPrintContext to its stream.
+*/
+static void flush_stream_context(StreamPrintContext *context) {
+    if (context->count == 0) return;
+    vfs_write(context->stream, (const uint8_t *)context->buffer, context->count);
+    context->count = 0;
+}
+
+/**
+ * Output a char to a stream, buffering it in the print context.
+ * 
+ * Parameters:
+ *   c: The character to print
+ *   context: The StreamPrintContext of the stream being printed to
+*/
+static int print_char_to_stream(int c, void *context) {
+    StreamPrintContext *stream = context;
+    if (stream->count == STREAM_PRINT_BUFFER_SIZE)
+        flush_stream_context(stream);
+    stream->buffer[stream->count++] = c;
+    return 1;
+}
+
 size_t fwrite(
     const void * restrict ptr, size_t size, size_t nmemb, 
     FILE * restrict stream
@@ -207,12 +251,9 @@ int putc(char c, FILE * restrict stream)
 
 int fputs(const char * restrict s, FILE * restrict stream) 
 {
-    int count = 0;
-    while (*s) {
-        fputc(*s, stream);
-        s++;
-        count++;
-    }
+    size_t count = strlen(s);
+    if (vfs_write(stream, (const uint8_t *)s, count) != count)
+        return EOF;
     return count;
 }
 
@@ -277,35 +318,41 @@ int sprintf(char * restrict s, const char * restrict format, ...) {
 int vfprintf(
     FILE * restrict stream, const char * restrict format, va_list arg
 ) {
-    format_print(format, stream, fputc, arg);
+    StreamPrintContext context = { .stream = stream, .count = 0 };
+    int result = format_print(format, &context, print_char_to_stream, arg);
+    flush_stream_context(&context);
+    return result;
 }
 
 int vprintf(const char * restrict format, va_list arg) {
-    format_print(format, stdout, fputc, arg);
+    return vfprintf(stdout, format, arg);
 }
 
 int vsnprintf(
     char * restrict s, size_t n, const char * restrict format, va_list arg
 ) {
-    array_max = n;
-    array_index = 0;
-    array_out = s;
-    limit_array_size = true;
-    int result = format_print(format, NULL, print_char_to_array, arg);
-    array_out[array_index] = '\0';
-    array_out = NULL;
+    ArrayPrintContext array = {
+        .out = s,
+        .index = 0,
+        .max = n,
+        .limit_size = true
+    };
+    int result = format_print(format, &array, print_char_to_array, arg);
+    if (n > 0) s[array.index] = '\0';
     return result;
 }
 
 int vsprintf(
     char * restrict s, const char * restrict format, va_list arg
 ) {
-    array_index = 0;
-    array_out = s;
-    limit_array_size = false;
-    int result = format_print(format, NULL, print_char_to_array, arg);
-    array_out[array_index] = '\0';
-    array_out = NULL;
+    ArrayPrintContext array = {
+        .out = s,
+        .index = 0,
+        .max = 0,
+        .limit_size = false
+    };
+    int result = format_print(format, &array, print_char_to_array, arg);
+    s[array.index] = '\0';
     return result;
 }
 
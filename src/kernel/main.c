@@ -16,26 +16,49 @@
 #include "bash.h"
 #include "disk.h"
 #include "fat.h"
+#include "thread.h"
+#include "timer.h"
+
+// Only show warnings and errors on the console while booting. The full log
+// can be seen with the dmesg command.
+#define QUIET_BOOT 1
+
+// How often the console is copied to the screen from the timer interrupt
+#define CONSOLE_FLUSH_MS 20
+
+// How often klogd exports binary log records
+#define KLOGD_INTERVAL_MS 50
 
 extern void _init();
 
 void loop();
 
-void timer(Registers* regs) {
-    // printf(".");
-}
-
 void keypress_handler(void *args) {
     KeypressEvent *event = args;
     if (event->ascii != '\0' && !event->released)
         printf("%c", event->ascii);
-    free(event);
+}
+
+/**
+ * Export binary log records in the background so slow writes to the host do
+ * not hold up event handling.
+*/
+void klogd(void *arg) {
+    for (;;) {
+        log_flush_binary();
+        thread_sleep(KLOGD_INTERVAL_MS);
+    }
 }
 
 void ASMCALL Start(BootData* boot_data) 
 {
     _init();
 
+#ifdef QUIET_BOOT
+    DebugLevel console_level = log_get_console_level();
+    log_set_console_level(LVL_WARN);
+#endif
+
     log_info("Main", "Kernel Started");
 
     vga_clear_screen();
@@ -45,16 +68,26 @@ void ASMCALL Start(BootData* boot_data)
 
     hal_initialize(boot_data);
 
-    printf("Initialized HAL\n");
+    log_info("Main", "Initialized HAL");
+
+    // Copy console output rendered since the last flush to the screen
+    timer_add_tick_hook(vga_flush, CONSOLE_FLUSH_MS, true);
 
-    irq_register_handler(0, timer);
-    enable_interrupts();
+    if (thread_create("klogd", klogd, NULL, THREAD_PRIORITY_LOW) == NULL)
+        log_error("Main", "Could not start klogd");
 
     kbd_initialize();
 
     disk_initialize();
     fat_initialize();
 
+    // Show the boot messages before anything else is printed
+    log_render();
+
+#ifdef QUIET_BOOT
+    log_set_console_level(console_level);
+#endif
+
     printf("\nReading TEXT.TXT:\n\n");
     FILE *file = fopen("TEST    TXT", "");
     if (file == NULL) {
@@ -72,9 +105,9 @@ void ASMCALL Start(BootData* boot_data)
 
 void loop() {
     for(;;) {
-        while (get_event_count() > 0) {
-            call_next_event();
-        }
-        halt();
+        while (call_next_event());
+        log_render();
+        vga_flush();
+        thread_wait_for_events();
     }
 }
\ No newline at end of file
@@ -0,0 +1,247 @@
+#include "task.h"
+
+#include <arch/i686/io.h>
+#include <arch/i686/smp.h>
+#include "events.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include "thread.h"
+
+typedef struct {
+    TaskFunction function;
+    void *arg;
+    TaskGroup *group;
+} Task;
+
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+    uint32_t grain;
+    RangeFunction function;
+    void *arg;
+    TaskGroup *group;
+} RangeTask;
+
+/**
+ * A Chase-Lev work-stealing deque. The owning CPU pushes and pops tasks at
+ * the bottom without locking, other CPUs steal from the top with a
+ * compare-and-swap. Only the last task needs the owner to race the thieves.
+*/
+typedef struct {
+    volatile int32_t top __attribute__((aligned(CACHE_LINE_SIZE)));
+    volatile int32_t bottom __attribute__((aligned(CACHE_LINE_SIZE)));
+    Task *tasks[TASK_DEQUE_SIZE];
+    TaskStats stats;
+} WorkDeque;
+
+static WorkDeque deques[MAX_CPUS];
+static volatile int cpu_count = 1;
+
+/**
+ * Add [task] to the bottom of [deque]. Must only be called by the CPU that
+ * owns the deque, with interrupts disabled so threads sharing the CPU can not
+ * interleave.
+ *
+ * Returns:
+ *   false if the deque is full
+*/
+static bool push(WorkDeque *deque, Task *task) {
+    int32_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    int32_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= TASK_DEQUE_SIZE) return false;
+
+    __atomic_store_n(
+        &deque->tasks[bottom & (TASK_DEQUE_SIZE - 1)], task, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * Take the newest task from the bottom of [deque]. Has the same restrictions
+ * as push.
+ *
+ * Returns:
+ *   The task, or NULL if the deque is empty or a thief took the last task
+*/
+static Task *pop(WorkDeque *deque) {
+    int32_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int32_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (top > bottom) {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    Task *task = __atomic_load_n(
+        &deque->tasks[bottom & (TASK_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (top == bottom) {
+        // The last task, race any thieves for it
+        if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1,
+                false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            task = NULL;
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+/**
+ * Take the oldest task from the top of [deque]. Safe to call from any CPU.
+ *
+ * Returns:
+ *   The task, or NULL if the deque is empty or another CPU took it first
+*/
+static Task *steal(WorkDeque *deque) {
+    int32_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int32_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) return NULL;
+
+    Task *task = __atomic_load_n(
+        &deque->tasks[top & (TASK_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1,
+            false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+    return task;
+}
+
+static void run_task(WorkDeque *deque, Task *task) {
+    TaskGroup *group = task->group;
+    task->function(task->arg);
+    free(task);
+
+    deque->stats.executed++;
+    __atomic_fetch_sub(&group->pending, 1, __ATOMIC_RELEASE);
+}
+
+void task_cpu_online(int cpu) {
+    if (cpu < MAX_CPUS && cpu >= cpu_count)
+        __atomic_store_n(&cpu_count, cpu + 1, __ATOMIC_RELEASE);
+}
+
+int task_cpu_count() {
+    return __atomic_load_n(&cpu_count, __ATOMIC_ACQUIRE);
+}
+
+void task_spawn(TaskGroup *group, TaskFunction function, void *arg) {
+    WorkDeque *deque = &deques[smp_cpu_id()];
+    __atomic_fetch_add(&group->pending, 1, __ATOMIC_RELAXED);
+
+    Task *task = malloc(sizeof(Task));
+    if (task != NULL) {
+        task->function = function;
+        task->arg = arg;
+        task->group = group;
+
+        uint32_t flags = save_and_disable_interrupts();
+        bool pushed = push(deque, task);
+        restore_interrupts(flags);
+
+        if (pushed) {
+            // Make sure the task is visible before looking for idle CPUs
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            smp_wake_idle_cpus();
+            return;
+        }
+
+        free(task);
+    }
+
+    // No room to queue the task, so run it now
+    deque->stats.overflowed++;
+    function(arg);
+    __atomic_fetch_sub(&group->pending, 1, __ATOMIC_RELEASE);
+}
+
+bool task_run_one() {
+    int cpu = smp_cpu_id();
+    WorkDeque *deque = &deques[cpu];
+
+    uint32_t flags = save_and_disable_interrupts();
+    Task *task = pop(deque);
+    restore_interrupts(flags);
+
+    // Look for work on the other CPUs, starting with the next one so thieves
+    // spread out over their victims
+    int count = __atomic_load_n(&cpu_count, __ATOMIC_ACQUIRE);
+    for (int i = 1; task == NULL && i < count; i++) {
+        task = steal(&deques[(cpu + i) % count]);
+        if (task != NULL) deque->stats.stolen++;
+    }
+
+    if (task == NULL) return false;
+    run_task(deque, task);
+    return true;
+}
+
+bool task_pending() {
+    int count = __atomic_load_n(&cpu_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        int32_t top = __atomic_load_n(&deques[i].top, __ATOMIC_ACQUIRE);
+        int32_t bottom = __atomic_load_n(&deques[i].bottom, __ATOMIC_ACQUIRE);
+        if (top < bottom) return true;
+    }
+    return false;
+}
+
+void task_wait(TaskGroup *group) {
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+        if (task_run_one()) continue;
+
+        // The remaining tasks are running elsewhere, let them finish. Only
+        // the boot processor has threads to switch to.
+        if (smp_cpu_id() == 0)
+            thread_yield();
+        else
+            cpu_relax();
+    }
+}
+
+/**
+ * Split the range in half until it is no bigger than the grain, spawning the
+ * upper halves as tasks, then run what is left.
+*/
+static void run_range(void *arg) {
+    RangeTask *range = arg;
+
+    while (range->last - range->first > range->grain) {
+        uint32_t middle =
+            range->first + (range->last - range->first) / 2;
+
+        RangeTask *upper = malloc(sizeof(RangeTask));
+        if (upper == NULL) break;
+
+        *upper = *range;
+        upper->first = middle;
+        range->last = middle;
+        task_spawn(range->group, run_range, upper);
+    }
+
+    range->function(range->first, range->last, range->arg);
+    free(range);
+}
+
+void parallel_for(
+    uint32_t first, uint32_t last, uint32_t grain,
+    RangeFunction function, void *arg
+) {
+    if (first >= last) return;
+    if (grain == 0) grain = 1;
+
+    RangeTask *range = malloc(sizeof(RangeTask));
+    if (range == NULL) {
+        function(first, last, arg);
+        return;
+    }
+
+    TaskGroup group = {0};
+    *range = (RangeTask){first, last, grain, function, arg, &group};
+    run_range(range);
+    task_wait(&group);
+}
+
+void task_get_stats(int cpu, TaskStats *stats) {
+    if (cpu < 0 || cpu >= MAX_CPUS) return;
+    *stats = deques[cpu].stats;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Most CPUs that can take part in running tasks
+#define MAX_CPUS 8
+
+// Number of tasks each CPU can have waiting. Must be a power of 2.
+#define TASK_DEQUE_SIZE 256
+
+typedef void (*TaskFunction)(void *arg);
+
+/**
+ * Called by parallel_for with a chunk of the range, from [first] up to but
+ * not including [last].
+*/
+typedef void (*RangeFunction)(uint32_t first, uint32_t last, void *arg);
+
+/**
+ * A set of spawned tasks that can be waited on together. Must be zeroed
+ * before the first task is spawned into it.
+*/
+typedef struct {
+    volatile int32_t pending;   // Tasks spawned that have not finished yet
+} TaskGroup;
+
+typedef struct {
+    uint32_t executed;          // Tasks run by this CPU
+    uint32_t stolen;            // Tasks this CPU took from another's deque
+    uint32_t overflowed;        // Tasks run at once because the deque was full
+} TaskStats;
+
+/**
+ * Add [cpu] to the CPUs whose deques are stolen from. The boot CPU is always
+ * online. Called as each application processor starts.
+*/
+void task_cpu_online(int cpu);
+
+/**
+ * Returns:
+ *   The number of CPUs taking part in running tasks
+*/
+int task_cpu_count();
+
+/**
+ * Queue [function] to run with [arg] on the current CPU's deque. It may be
+ * stolen and run by any other CPU. Tasks must not sleep or block.
+ *
+ * Parameters:
+ *   group: The group to add the task to
+ *   function: The function to run
+ *   arg: The argument to pass to function
+*/
+void task_spawn(TaskGroup *group, TaskFunction function, void *arg);
+
+/**
+ * Run tasks until every task in [group] has finished. Tasks from the current
+ * CPU's deque are run first, then tasks are stolen from other CPUs.
+*/
+void task_wait(TaskGroup *group);
+
+/**
+ * Run one task, taking it from the current CPU's deque or stealing it from
+ * another CPU.
+ *
+ * Returns:
+ *   Whether a task was run
+*/
+bool task_run_one();
+
+/**
+ * Returns:
+ *   Whether any CPU has tasks waiting in its deque
+*/
+bool task_pending();
+
+/**
+ * Call [function] on chunks of the range [first, last) of at most [grain]
+ * items and wait for them all. The range is split in half recursively so
+ * idle CPUs steal the largest pieces of work first.
+ *
+ * Parameters:
+ *   first: The first index
+ *   last: One past the last index
+ *   grain: The largest chunk that is not split any further
+ *   function: The function to call for each chunk
+ *   arg: The argument to pass to function
+*/
+void parallel_for(
+    uint32_t first, uint32_t last, uint32_t grain,
+    RangeFunction function, void *arg
+);
+
+void task_get_stats(int cpu, TaskStats *stats);
@@ -0,0 +1,85 @@
+#include "tasklet.h"
+
+#include <arch/i686/io.h>
+#include <stddef.h>
+
+static Tasklet *head = NULL;
+static Tasklet *tail = NULL;
+static bool running = false;
+static TaskletStats stats;
+
+/**
+ * Take the first waiting tasklet off the queue. Must be called with
+ * interrupts disabled.
+*/
+static Tasklet *take_next() {
+    Tasklet *tasklet = head;
+    if (tasklet == NULL) return NULL;
+
+    head = tasklet->next;
+    if (head == NULL) tail = NULL;
+    tasklet->next = NULL;
+
+    // Clear the flag before running so the tasklet can be scheduled again
+    // for work that arrives while it runs
+    tasklet->scheduled = false;
+    return tasklet;
+}
+
+void tasklet_schedule(Tasklet *tasklet) {
+    uint32_t flags = save_and_disable_interrupts();
+
+    if (!tasklet->scheduled) {
+        tasklet->scheduled = true;
+        tasklet->next = NULL;
+        if (tail == NULL)
+            head = tasklet;
+        else
+            tail->next = tasklet;
+        tail = tasklet;
+    }
+
+    restore_interrupts(flags);
+}
+
+bool tasklet_pending() {
+    return head != NULL;
+}
+
+void tasklet_run_pending() {
+    uint32_t flags = save_and_disable_interrupts();
+    if (running || head == NULL) {
+        restore_interrupts(flags);
+        return;
+    }
+    running = true;
+
+    for (int i = 0; i < TASKLET_BUDGET; i++) {
+        Tasklet *tasklet = take_next();
+        if (tasklet == NULL) break;
+
+        enable_interrupts();
+        uint64_t start = read_tsc();
+        tasklet->function(tasklet->arg);
+        uint64_t cycles = read_tsc() - start;
+        disable_interrupts();
+
+        stats.runs++;
+        stats.total_cycles += cycles;
+        if (cycles > stats.max_cycles) stats.max_cycles = cycles;
+    }
+
+    if (head != NULL) stats.deferred++;
+    running = false;
+    restore_interrupts(flags);
+}
+
+bool tasklet_running() {
+    return running;
+}
+
+void tasklet_get_stats(TaskletStats *out) {
+    uint32_t flags = save_and_disable_interrupts();
+    *out = stats;
+    restore_interrupts(flags);
+}
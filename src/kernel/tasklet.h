@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Most tasklets run on one interrupt exit. The rest are left for the next
+// interrupt or the idle thread so a flood can not starve the threads.
+#define TASKLET_BUDGET 32
+
+typedef void (*TaskletFunction)(void *arg);
+
+/**
+ * The bottom half of an interrupt handler. The top half captures the state
+ * of the hardware and schedules the tasklet, which then does the rest of the
+ * work with interrupts enabled after the interrupt has been acknowledged.
+ * Tasklets never run at the same time as each other, and must not sleep or
+ * block.
+*/
+typedef struct Tasklet {
+    struct Tasklet *next;
+    TaskletFunction function;
+    void *arg;
+    volatile bool scheduled;
+} Tasklet;
+
+#define TASKLET_INIT(function, arg) { NULL, (function), (arg), false }
+
+typedef struct {
+    uint32_t runs;              // Tasklets run
+    uint32_t deferred;          // Times the budget ran out with work left
+    uint64_t total_cycles;      // TSC cycles spent running tasklets
+    uint64_t max_cycles;        // Longest single tasklet
+} TaskletStats;
+
+/**
+ * Queue [tasklet] to run once the current interrupt returns. Scheduling a
+ * tasklet that is already waiting does nothing, so it must handle all the
+ * work that has built up when it runs. Safe to call from interrupt handlers.
+*/
+void tasklet_schedule(Tasklet *tasklet);
+
+/**
+ * Returns:
+ *   Whether any tasklets are waiting to run
+*/
+bool tasklet_pending();
+
+/**
+ * Run waiting tasklets, up to TASKLET_BUDGET of them, with interrupts
+ * enabled. Does nothing if tasklets are already being run further up the
+ * stack. Interrupts are restored to their previous state on return.
+*/
+void tasklet_run_pending();
+
+/**
+ * Returns:
+ *   Whether tasklet_run_pending is running tasklets
+*/
+bool tasklet_running();
+
+void tasklet_get_stats(TaskletStats *stats);
@@ -0,0 +1,325 @@
+#include "thread.h"
+
+#include <arch/i686/fpu.h>
+#include <arch/i686/io.h>
+#include <arch/i686/thread.h>
+#include "debug.h"
+#include "events.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include "tasklet.h"
+#include "timer.h"
+
+static Thread main_thread = {
+    .id = 0,
+    .name = "main",
+    .priority = THREAD_PRIORITY_NORMAL,
+    .state = THREAD_RUNNING,
+};
+
+static Thread *current = &main_thread;
+static Thread *idle_thread = NULL;
+
+// One FIFO of ready threads per priority
+static Thread *ready_head[THREAD_PRIORITY_COUNT];
+static Thread *ready_tail[THREAD_PRIORITY_COUNT];
+
+static Thread *sleepers = NULL;     // Sorted by wake_tick
+static Thread *dead = NULL;         // Exited threads waiting to be freed
+static Thread *event_waiter = NULL; // Blocked in thread_wait_for_events
+
+static volatile bool need_resched = false;
+static uint32_t slice_ticks = 1;
+static uint32_t slice_left = 1;
+static int next_id = 1;
+
+static void make_ready(Thread *thread) {
+    thread->state = THREAD_READY;
+    thread->next = NULL;
+
+    ThreadPriority priority = thread->priority;
+    if (ready_tail[priority] == NULL)
+        ready_head[priority] = thread;
+    else
+        ready_tail[priority]->next = thread;
+    ready_tail[priority] = thread;
+
+    if (priority < current->priority) need_resched = true;
+}
+
+/**
+ * Take the first ready thread with a priority of at least [lowest].
+ *
+ * Returns:
+ *   The thread, or NULL if there is none
+*/
+static Thread *take_ready(ThreadPriority lowest) {
+    for (int priority = 0; priority <= lowest; priority++) {
+        Thread *thread = ready_head[priority];
+        if (thread == NULL) continue;
+
+        ready_head[priority] = thread->next;
+        if (ready_head[priority] == NULL) ready_tail[priority] = NULL;
+        thread->next = NULL;
+        return thread;
+    }
+    return NULL;
+}
+
+/**
+ * Pick the next thread to run and switch to it. If the current thread can
+ * still run it only gives way to threads of the same or higher priority.
+ * Must be called with interrupts disabled.
+*/
+static void schedule() {
+    Thread *previous = current;
+    Thread *next;
+
+    if (previous->state == THREAD_RUNNING) {
+        next = take_ready(previous->priority);
+        if (next == NULL) {
+            need_resched = false;
+            slice_left = slice_ticks;
+            return;
+        }
+        make_ready(previous);
+    } else {
+        // The idle thread is always ready so there is always something
+        next = take_ready(THREAD_PRIORITY_IDLE);
+    }
+
+    need_resched = false;
+    slice_left = slice_ticks;
+    next->state = THREAD_RUNNING;
+    current = next;
+    fpu_switch_to(next);
+    context_switch(&previous->esp, next->esp);
+}
+
+/**
+ * Free the stacks of threads that have exited. Never called on the stack of
+ * a dead thread since it only runs in threads that are still alive.
+*/
+static void reap_threads() {
+    uint32_t flags = save_and_disable_interrupts();
+    Thread *list = dead;
+    dead = NULL;
+    restore_interrupts(flags);
+
+    while (list != NULL) {
+        Thread *next = list->next;
+        free(list->fpu_state);
+        free(list->stack);
+        free(list);
+        list = next;
+    }
+}
+
+/**
+ * Wake the sleepers that are due and count down the time slice. Runs in the
+ * timer interrupt.
+*/
+static void thread_tick() {
+    uint32_t now = timer_ticks();
+    while (sleepers != NULL && (int32_t)(now - sleepers->wake_tick) >= 0) {
+        Thread *thread = sleepers;
+        sleepers = thread->next;
+        make_ready(thread);
+    }
+
+    if (current == idle_thread) {
+        for (int i = 0; i < THREAD_PRIORITY_IDLE; i++)
+            if (ready_head[i] != NULL) need_resched = true;
+    } else if (--slice_left == 0) {
+        slice_left = slice_ticks;
+        need_resched = true;
+    }
+}
+
+/**
+ * The first function run by every new thread. It is reached by returning
+ * from context_switch.
+*/
+static void thread_trampoline() {
+    enable_interrupts();
+    current->entry(current->arg);
+    thread_exit();
+}
+
+/**
+ * Returns:
+ *   The number of ticks until the first sleeper should wake up
+*/
+static uint32_t ticks_until_wake() {
+    if (sleepers == NULL) return UINT32_MAX;
+
+    int32_t remaining = sleepers->wake_tick - timer_ticks();
+    return remaining > 0 ? remaining : 0;
+}
+
+/**
+ * Halt until there is something to run. The tick is stopped while halted so
+ * the CPU is only woken by the next timer, sleeper or device interrupt.
+*/
+static void idle(void *arg) {
+    for (;;) {
+        // Finish bottom halves left over when an interrupt ran out of budget
+        tasklet_run_pending();
+
+        // Switch to threads woken while the tasklets ran, and wake the main
+        // thread for the events they posted
+        disable_interrupts();
+        thread_preempt();
+        if (tasklet_pending()) {
+            enable_interrupts();
+            continue;
+        }
+
+        timer_idle_enter(ticks_until_wake());
+        enable_interrupts_and_halt();
+        timer_idle_exit();
+    }
+}
+
+void thread_initialize() {
+    slice_ticks = timer_ms_to_ticks(THREAD_TIME_SLICE_MS);
+    slice_left = slice_ticks;
+
+    idle_thread = thread_create("idle", idle, NULL, THREAD_PRIORITY_IDLE);
+    if (idle_thread == NULL) panic("Thread", "Could not create the idle thread");
+
+    // The time slice only matters when something other than idle can run,
+    // and that is always woken by an interrupt which restarts the tick
+    timer_add_tick_hook(thread_tick, 1, false);
+    log_info("Thread", "Scheduler running, time slice %u ticks", slice_ticks);
+}
+
+Thread *thread_create(
+    const char *name, ThreadEntry entry, void *arg, ThreadPriority priority
+) {
+    reap_threads();
+
+    Thread *thread = malloc(sizeof(Thread));
+    void *stack = aligned_alloc(16, THREAD_STACK_SIZE);
+    if (thread == NULL || stack == NULL) {
+        free(thread);
+        free(stack);
+        return NULL;
+    }
+
+    thread->name = name;
+    thread->entry = entry;
+    thread->arg = arg;
+    thread->priority = priority;
+    thread->stack = stack;
+    thread->fpu_state = NULL;
+
+    // Build the frame context_switch expects to pop: edi, esi, ebx, ebp and
+    // the return address, which starts the thread in thread_trampoline
+    uint32_t *top = (uint32_t *)((uint8_t *)stack + THREAD_STACK_SIZE);
+    *--top = 0;                             // thread_trampoline's return
+    *--top = (uint32_t)thread_trampoline;
+    *--top = 0;                             // ebp
+    *--top = 0;                             // ebx
+    *--top = 0;                             // esi
+    *--top = 0;                             // edi
+    thread->esp = (uint32_t)top;
+
+    uint32_t flags = save_and_disable_interrupts();
+    thread->id = next_id++;
+    make_ready(thread);
+    if (need_resched) schedule();
+    restore_interrupts(flags);
+
+    return thread;
+}
+
+Thread *thread_current() {
+    return current;
+}
+
+void thread_yield() {
+    uint32_t flags = save_and_disable_interrupts();
+    schedule();
+    restore_interrupts(flags);
+}
+
+void thread_sleep(uint32_t ms) {
+    uint32_t flags = save_and_disable_interrupts();
+
+    current->state = THREAD_SLEEPING;
+    current->wake_tick = timer_ticks() + timer_ms_to_ticks(ms);
+
+    Thread **link = &sleepers;
+    while (*link != NULL &&
+        (int32_t)((*link)->wake_tick - current->wake_tick) <= 0
+    )
+        link = &(*link)->next;
+    current->next = *link;
+    *link = current;
+
+    schedule();
+    restore_interrupts(flags);
+}
+
+void thread_block() {
+    uint32_t flags = save_and_disable_interrupts();
+    current->state = THREAD_BLOCKED;
+    schedule();
+    restore_interrupts(flags);
+}
+
+void thread_wake(Thread *thread) {
+    uint32_t flags = save_and_disable_interrupts();
+
+    if (thread->state == THREAD_SLEEPING) {
+        Thread **link = &sleepers;
+        while (*link != NULL && *link != thread) link = &(*link)->next;
+        if (*link != NULL) *link = thread->next;
+        make_ready(thread);
+    } else if (thread->state == THREAD_BLOCKED) {
+        make_ready(thread);
+    }
+
+    restore_interrupts(flags);
+}
+
+void thread_exit() {
+    disable_interrupts();
+    fpu_thread_exit(current);
+    current->state = THREAD_DEAD;
+    current->next = dead;
+    dead = current;
+    schedule();
+
+    panic("Thread", "A dead thread was scheduled");
+}
+
+void thread_wait_for_events() {
+    reap_threads();
+
+    uint32_t flags = save_and_disable_interrupts();
+    if (get_event_count() == 0) {
+        event_waiter = current;
+        current->state = THREAD_BLOCKED;
+        schedule();
+    }
+    restore_interrupts(flags);
+}
+
+void thread_preempt() {
+    // An interrupt ended an idle period, so restart the tick before anything
+    // looks at the time
+    if (current == idle_thread) timer_idle_exit();
+
+    if (event_waiter != NULL && get_event_count() > 0) {
+        Thread *thread = event_waiter;
+        event_waiter = NULL;
+        make_ready(thread);
+    }
+
+    // Switching away from tasklets run by the idle thread would leave them
+    // marked as running, and no interrupt exit would run any until idle
+    // got the CPU back. Idle switches once they are done.
+    if (need_resched && !tasklet_running()) schedule();
+}
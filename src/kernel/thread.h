@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Size of each thread's kernel stack
+#define THREAD_STACK_SIZE 16384
+
+// How long a thread runs before another of the same priority gets a turn
+#define THREAD_TIME_SLICE_MS 10
+
+typedef void (*ThreadEntry)(void *arg);
+
+/**
+ * Thread priorities, from the most to the least urgent. A ready thread always
+ * runs before any thread of a lower priority. The idle priority is only used
+ * by the idle thread.
+*/
+typedef enum {
+    THREAD_PRIORITY_HIGH,
+    THREAD_PRIORITY_NORMAL,
+    THREAD_PRIORITY_LOW,
+    THREAD_PRIORITY_IDLE,
+    THREAD_PRIORITY_COUNT
+} ThreadPriority;
+
+typedef enum {
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_SLEEPING,
+    THREAD_DEAD
+} ThreadState;
+
+typedef struct Thread {
+    uint32_t esp;               // Saved stack pointer while not running
+    int id;
+    const char *name;
+    ThreadPriority priority;
+    ThreadState state;
+    void *stack;                // NULL for the boot thread
+    ThreadEntry entry;
+    void *arg;
+    uint32_t wake_tick;         // Tick to wake up on while sleeping
+    void *fpu_state;            // Saved FPU and SSE registers, NULL until used
+    struct Thread *next;        // Next thread in a run, sleep or dead queue
+} Thread;
+
+/**
+ * Turn the boot code into the main thread and start the idle thread and the
+ * preemption tick. Must be called after timer_initialize.
+*/
+void thread_initialize();
+
+/**
+ * Create a kernel thread that runs [entry] with [arg] on its own stack. The
+ * thread exits when [entry] returns.
+ * 
+ * Parameters:
+ *   name: The name of the thread
+ *   entry: The function to run
+ *   arg: The argument to pass to entry
+ *   priority: The priority to schedule the thread at
+ * 
+ * Returns:
+ *   The new thread, or NULL if its stack could not be allocated
+*/
+Thread *thread_create(
+    const char *name, ThreadEntry entry, void *arg, ThreadPriority priority
+);
+
+Thread *thread_current();
+
+/**
+ * Let another ready thread of the same or higher priority run.
+*/
+void thread_yield();
+
+/**
+ * Stop the current thread from running for at least [ms] milliseconds.
+*/
+void thread_sleep(uint32_t ms);
+
+/**
+ * Stop the current thread until thread_wake is called on it.
+*/
+void thread_block();
+
+/**
+ * Make a blocked or sleeping [thread] ready to run again. Safe to call from
+ * interrupt handlers.
+*/
+void thread_wake(Thread *thread);
+
+void thread_exit();
+
+/**
+ * Block the main thread until an interrupt handler has posted an event.
+ * Other threads run in the meantime.
+*/
+void thread_wait_for_events();
+
+/**
+ * Switch threads if the current one has used up its time slice or a higher
+ * priority thread has been woken, unless tasklets are running. Called on the
+ * way out of an interrupt handler, after the interrupt has been
+ * acknowledged, and by the idle thread after running tasklets. Must be
+ * called with interrupts disabled.
+*/
+void thread_preempt();
@@ -0,0 +1,397 @@
+#include "timer.h"
+
+#include <arch/i686/irq.h>
+#include <arch/i686/io.h>
+#include <arch/i686/pit.h>
+#include "debug.h"
+#include "events.h"
+#include <stddef.h>
+
+// The wheel has WHEEL_LEVELS levels of WHEEL_SIZE slots. Each level covers
+// WHEEL_SIZE times the range of the one below it.
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+// Timers further away than this are parked in the top level slot that is
+// cascaded last, and put back in the wheel when it is
+#define WHEEL_MAX_DELAY ((1u << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+// Longest delay timer_schedule accepts, in ticks. Expiry ticks are compared
+// with signed differences so anything further away would look overdue.
+#define TIMER_MAX_DELAY_TICKS INT32_MAX
+
+typedef struct Timer {
+    struct Timer *next;
+    struct Timer *prev;
+    uint32_t expires;           // Tick to expire on
+    TimerHandler handler;
+    void *arg;
+    uint16_t generation;        // Incremented each time the timer is reused
+    bool pending;
+} Timer;
+
+typedef struct {
+    TimerHandler handler;
+    void *arg;
+} TimerExpiry;
+
+typedef struct {
+    TickHook hook;
+    uint32_t period;            // In ticks
+    uint32_t countdown;
+    bool wake_idle;             // Ends idle periods to keep its period
+} TickHookEntry;
+
+static volatile uint32_t ticks = 0;
+static uint32_t frequency = 0;
+
+static Timer pool[TIMER_POOL_SIZE];
+static Timer *free_timers = NULL;
+
+// Each slot is a circular list with a sentinel node
+static Timer wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint32_t wheel_tick = 0;     // The next tick the wheel will process
+
+static TickHookEntry tick_hooks[TIMER_MAX_TICK_HOOKS];
+static int tick_hook_count = 0;
+
+// Set while the PIT is in one-shot mode for an idle period of idle_ticks
+static volatile bool tickless = false;
+static uint32_t idle_ticks = 0;
+static TimerIdleStats idle_stats;
+
+static void list_unlink(Timer *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+}
+
+static void list_append(Timer *head, Timer *timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+/**
+ * Put [timer] in the slot for its expiry tick relative to the wheel's
+ * current position. Must be called with interrupts disabled.
+*/
+static void wheel_insert(Timer *timer) {
+    uint32_t delta = timer->expires - wheel_tick;
+
+    // Already due, it will be expired on the next tick
+    if ((int32_t)delta < 0) {
+        timer->expires = wheel_tick;
+        delta = 0;
+    }
+
+    // The slot before the current one on the top level is the furthest
+    // away, and never the one being cascaded
+    if (delta > WHEEL_MAX_DELAY) {
+        int top = WHEEL_LEVELS - 1;
+        int slot = ((wheel_tick >> (WHEEL_BITS * top)) - 1) & WHEEL_MASK;
+        list_append(&wheel[top][slot], timer);
+        return;
+    }
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1u << (WHEEL_BITS * (level + 1))))
+        level++;
+
+    int slot = (timer->expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    list_append(&wheel[level][slot], timer);
+}
+
+/**
+ * Move every timer in slot [slot] of [level] down to the lower levels.
+*/
+static void cascade(int level, int slot) {
+    Timer *head = &wheel[level][slot];
+    while (head->next != head) {
+        Timer *timer = head->next;
+        list_unlink(timer);
+        wheel_insert(timer);
+    }
+}
+
+static void release_timer(Timer *timer) {
+    timer->pending = false;
+    timer->generation++;
+    timer->next = free_timers;
+    free_timers = timer;
+}
+
+static void timer_dispatch(void *payload) {
+    TimerExpiry *expiry = payload;
+    expiry->handler(expiry->arg);
+}
+
+/**
+ * Expire every timer that is due by the current tick. Runs in the timer
+ * interrupt.
+*/
+static void run_wheel() {
+    while ((int32_t)(ticks - wheel_tick) >= 0) {
+        int slot = wheel_tick & WHEEL_MASK;
+
+        // Refill the lowest level from the one above each time it wraps
+        for (int level = 1; slot == 0 && level < WHEEL_LEVELS; level++) {
+            int upper = (wheel_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+            cascade(level, upper);
+            if (upper != 0) break;
+        }
+
+        Timer *head = &wheel[0][slot];
+        while (head->next != head) {
+            Timer *timer = head->next;
+            list_unlink(timer);
+
+            TimerExpiry expiry = { timer->handler, timer->arg };
+            release_timer(timer);
+
+            // If the queue is full the expiry is counted as dropped there
+            add_event(EVENT_SOURCE_TIMER, timer_dispatch, &expiry, sizeof(expiry));
+        }
+
+        wheel_tick++;
+    }
+}
+
+/**
+ * Advance time by [elapsed] ticks. Hooks that fell due in that time are
+ * only called once.
+*/
+static void advance(uint32_t elapsed) {
+    ticks += elapsed;
+
+    for (int i = 0; i < tick_hook_count; i++) {
+        TickHookEntry *entry = &tick_hooks[i];
+        if (entry->countdown <= elapsed) {
+            entry->countdown = entry->period;
+            entry->hook();
+        } else {
+            entry->countdown -= elapsed;
+        }
+    }
+
+    run_wheel();
+}
+
+/**
+ * Returns:
+ *   The number of ticks until the wheel next has work to do, up to [limit]
+*/
+static uint32_t ticks_until_next_timer(uint32_t limit) {
+    bool upper_pending = false;
+    for (int level = 1; level < WHEEL_LEVELS && !upper_pending; level++)
+        for (int slot = 0; slot < WHEEL_SIZE; slot++)
+            if (wheel[level][slot].next != &wheel[level][slot]) {
+                upper_pending = true;
+                break;
+            }
+
+    // wheel_tick is processed on the next tick, so slot n is n + 1 ticks away
+    for (uint32_t n = 0; n + 1 < limit && n < WHEEL_SIZE; n++) {
+        uint32_t tick = wheel_tick + n;
+        int slot = tick & WHEEL_MASK;
+        if (wheel[0][slot].next != &wheel[0][slot]) return n + 1;
+
+        // Timers on the upper levels are cascaded down when level 0 wraps
+        if (slot == 0 && upper_pending) return n + 1;
+    }
+    return limit;
+}
+
+static void handle_tick() {
+    if (tickless) {
+        // The one-shot has run out, so the whole idle period has passed
+        tickless = false;
+        pit_set_periodic(frequency);
+        advance(idle_ticks);
+        return;
+    }
+
+    advance(1);
+}
+
+static bool timer_fast_interrupt(int interrupt) {
+    handle_tick();
+
+    // The tick hooks may have used up the time slice or woken a thread
+    return true;
+}
+
+static void timer_interrupt(Registers *regs) {
+    handle_tick();
+}
+
+void timer_initialize(uint32_t hz) {
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < WHEEL_SIZE; slot++) {
+            wheel[level][slot].next = &wheel[level][slot];
+            wheel[level][slot].prev = &wheel[level][slot];
+        }
+    }
+
+    free_timers = NULL;
+    for (int i = TIMER_POOL_SIZE - 1; i >= 0; i--) {
+        pool[i].pending = false;
+        pool[i].next = free_timers;
+        free_timers = &pool[i];
+    }
+
+    ticks = 0;
+    wheel_tick = 1;
+    frequency = pit_set_periodic(hz);
+    if (!irq_register_fast_handler(0, timer_fast_interrupt))
+        irq_register_handler(0, timer_interrupt);
+
+    log_info("Timer", "PIT running at %u Hz", frequency);
+}
+
+uint32_t timer_ticks() {
+    return ticks;
+}
+
+uint32_t timer_frequency() {
+    return frequency;
+}
+
+uint32_t timer_ms_to_ticks(uint32_t ms) {
+    uint64_t result = ((uint64_t)ms * frequency + 999) / 1000;
+    if (result > UINT32_MAX) return UINT32_MAX;
+    return result == 0 ? 1 : result;
+}
+
+TimerId timer_schedule(uint32_t delay_ms, TimerHandler handler, void *arg) {
+    uint32_t delay = timer_ms_to_ticks(delay_ms);
+    if (delay > TIMER_MAX_DELAY_TICKS) return 0;
+
+    uint32_t flags = save_and_disable_interrupts();
+
+    Timer *timer = free_timers;
+    if (timer == NULL) {
+        restore_interrupts(flags);
+        return 0;
+    }
+    free_timers = timer->next;
+
+    timer->expires = ticks + delay;
+    timer->handler = handler;
+    timer->arg = arg;
+    timer->pending = true;
+    wheel_insert(timer);
+
+    TimerId id = ((uint32_t)timer->generation << 16) | (timer - pool + 1);
+    restore_interrupts(flags);
+    return id;
+}
+
+bool timer_cancel(TimerId id) {
+    uint32_t index = (id & 0xFFFF) - 1;
+    if (index >= TIMER_POOL_SIZE) return false;
+
+    Timer *timer = &pool[index];
+    bool cancelled = false;
+    uint32_t flags = save_and_disable_interrupts();
+
+    if (timer->pending && timer->generation == id >> 16) {
+        list_unlink(timer);
+        release_timer(timer);
+        cancelled = true;
+    }
+
+    restore_interrupts(flags);
+    return cancelled;
+}
+
+bool timer_add_tick_hook(TickHook hook, uint32_t period_ms, bool wake_idle) {
+    if (tick_hook_count == TIMER_MAX_TICK_HOOKS) return false;
+
+    uint32_t flags = save_and_disable_interrupts();
+    TickHookEntry *entry = &tick_hooks[tick_hook_count];
+    entry->hook = hook;
+    entry->period = timer_ms_to_ticks(period_ms);
+    entry->countdown = entry->period;
+    entry->wake_idle = wake_idle;
+    tick_hook_count++;
+    restore_interrupts(flags);
+
+    return true;
+}
+
+bool timer_idle_enter(uint32_t limit) {
+    uint16_t divisor = pit_get_divisor();
+    uint32_t max_ticks = 0xFFFF / divisor;
+    if (limit > max_ticks) limit = max_ticks;
+
+    // Hooks such as the console flush keep their period while idle, the
+    // others are run once the tick restarts
+    for (int i = 0; i < tick_hook_count; i++) {
+        TickHookEntry *entry = &tick_hooks[i];
+        if (entry->wake_idle && entry->countdown < limit)
+            limit = entry->countdown;
+    }
+
+    uint32_t sleep = ticks_until_next_timer(limit);
+    if (sleep <= 1) return false;
+
+    idle_ticks = sleep;
+    tickless = true;
+    pit_set_oneshot(sleep * divisor);
+
+    idle_stats.entries++;
+    idle_stats.skipped_ticks += sleep - 1;
+    return true;
+}
+
+void timer_idle_exit() {
+    uint32_t flags = save_and_disable_interrupts();
+    if (!tickless) {
+        restore_interrupts(flags);
+        return;
+    }
+
+    // Woken early by another interrupt. Work out how far the one-shot got,
+    // rounding to the nearest tick, and go back to the periodic tick.
+    uint16_t divisor = pit_get_divisor();
+    uint16_t count = pit_read_count();
+    uint32_t programmed = idle_ticks * divisor;
+    uint32_t elapsed = count <= programmed ?
+        (programmed - count + divisor / 2) / divisor : idle_ticks;
+
+    tickless = false;
+    pit_set_periodic(frequency);
+    idle_stats.early_wakeups++;
+    if (elapsed > 0) advance(elapsed);
+
+    restore_interrupts(flags);
+}
+
+void timer_get_idle_stats(TimerIdleStats *stats) {
+    uint32_t flags = save_and_disable_interrupts();
+    *stats = idle_stats;
+    restore_interrupts(flags);
+}
+
+void timeout_start(Timeout *timeout, uint32_t ms) {
+    timeout->start = ticks;
+    timeout->length = timer_ms_to_ticks(ms);
+    timeout->polled = 0;
+    timeout->last_count = pit_read_count();
+}
+
+bool timeout_expired(Timeout *timeout) {
+    if (ticks - timeout->start >= timeout->length) return true;
+
+    // The tick count does not advance with interrupts disabled, so also
+    // count the times the PIT counter has been reloaded
+    uint16_t count = pit_read_count();
+    if (count > timeout->last_count) timeout->polled++;
+    timeout->last_count = count;
+
+    return timeout->polled >= timeout->length;
+}
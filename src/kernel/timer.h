@@ -0,0 +1,147 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Default rate of the timer tick in Hz
+#define TIMER_HZ 1000
+
+// Number of timers that can be scheduled at once
+#define TIMER_POOL_SIZE 128
+
+// Number of tick hooks that can be registered
+#define TIMER_MAX_TICK_HOOKS 4
+
+typedef void (*TimerHandler)(void *arg);
+typedef void (*TickHook)();
+
+// Identifies a scheduled timer. 0 is never a valid id.
+typedef uint32_t TimerId;
+
+/**
+ * Counters for the idle periods run with the periodic tick stopped.
+*/
+typedef struct {
+    uint32_t entries;           // Idle periods run without the tick
+    uint32_t early_wakeups;     // Idle periods cut short by another interrupt
+    uint32_t skipped_ticks;     // Tick interrupts that were not needed
+} TimerIdleStats;
+
+/**
+ * A busy-wait timeout. It also works with interrupts disabled by watching
+ * the PIT counter reload when the tick count can not advance.
+*/
+typedef struct {
+    uint32_t start;
+    uint32_t length;            // In ticks
+    uint32_t polled;            // Counter reloads seen while polling
+    uint16_t last_count;
+} Timeout;
+
+/**
+ * Program the PIT to tick at [hz] and start the timing wheel.
+ * 
+ * Parameters:
+ *   hz: The tick rate
+*/
+void timer_initialize(uint32_t hz);
+
+/**
+ * Returns:
+ *   The number of ticks since the timer was initialized
+*/
+uint32_t timer_ticks();
+
+/**
+ * Returns:
+ *   The tick rate in Hz
+*/
+uint32_t timer_frequency();
+
+/**
+ * Convert [ms] milliseconds to timer ticks, rounding up.
+ * 
+ * Returns:
+ *   The number of ticks, at least 1
+*/
+uint32_t timer_ms_to_ticks(uint32_t ms);
+
+/**
+ * Call [handler] with [arg] from the event loop once [delay_ms] milliseconds
+ * have passed. Insertion and cancellation are O(1).
+ * 
+ * Parameters:
+ *   delay_ms: The minimum delay before the handler is called
+ *   handler: The function to call
+ *   arg: The argument to pass to the handler
+ * 
+ * Returns:
+ *   The id of the timer, or 0 if too many timers are scheduled or the delay
+ *   is over 2^31 - 1 ticks
+*/
+TimerId timer_schedule(uint32_t delay_ms, TimerHandler handler, void *arg);
+
+/**
+ * Stop a timer from expiring.
+ * 
+ * Parameters:
+ *   id: The timer returned by timer_schedule
+ * 
+ * Returns:
+ *   Whether the timer was pending and has been cancelled
+*/
+bool timer_cancel(TimerId id);
+
+/**
+ * Call [hook] from the timer interrupt every [period_ms] milliseconds. Hooks
+ * run in interrupt context so they must be short.
+ * 
+ * Parameters:
+ *   hook: The function to call
+ *   period_ms: How often to call it
+ *   wake_idle: Whether idle periods end in time to call it. Otherwise a hook
+ *              that fell due while the tick was stopped is called once when
+ *              it restarts.
+ * 
+ * Returns:
+ *   Whether the hook was registered
+*/
+bool timer_add_tick_hook(TickHook hook, uint32_t period_ms, bool wake_idle);
+
+/**
+ * Stop the periodic tick until the next timer or waking tick hook is due or
+ * [limit] ticks have passed, whichever is first, by programming the PIT as a
+ * one-shot. Must be called with interrupts disabled, just before halting.
+ * 
+ * Parameters:
+ *   limit: The most ticks to go without an interrupt
+ * 
+ * Returns:
+ *   Whether the tick was stopped. It is left running when the next timer is
+ *   due on the next tick anyway.
+*/
+bool timer_idle_enter(uint32_t limit);
+
+/**
+ * Restart the periodic tick after an idle period ended by an interrupt
+ * other than the timer, and catch up on the ticks that were missed. Does
+ * nothing if the tick is running.
+*/
+void timer_idle_exit();
+
+void timer_get_idle_stats(TimerIdleStats *stats);
+
+/**
+ * Start a timeout of [ms] milliseconds.
+ * 
+ * Parameters:
+ *   timeout: The timeout to start
+ *   ms: The length of the timeout
+*/
+void timeout_start(Timeout *timeout, uint32_t ms);
+
+/**
+ * Returns:
+ *   Whether [timeout] has run out
+*/
+bool timeout_expired(Timeout *timeout);